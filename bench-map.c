@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2007 Jonathan Moore Liles
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General
+ * Public License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* bench-map.c
+ *
+ * Linux Pseudo MIDI Input -- Mapping Benchmark
+ *
+ * Times lsmi-ps3's handle_event(), mapping and all, from input event to the
+ * sequencer write, which is replaced by one that only counts. Built once
+ * with the mapping table (bench-map) and once with the mapping compiled in
+ * (bench-map-fixed), from the driver's own source, so `make bench` compares
+ * the two on the same events. Those are replayed from a flight recorder
+ * dump or other evemu recording if one is given, or else a pad being played.
+ *
+ * 	bench-map [recording]
+ *
+ */
+
+#include <time.h>
+
+/* everything but the driver's main() */
+#define main ps3_main
+#include "lsmi-ps3.c"
+#undef main
+
+#define MAX_EVENTS 65536
+#define BENCH_EVENTS 2000000						/* per round, at least */
+#define ROUNDS 7
+
+static struct input_event events[ MAX_EVENTS ];
+static int nevents;
+static unsigned long sent;
+
+/**
+ * Stands in for the sequencer: counts.
+ */
+int
+snd_seq_event_output_direct ( snd_seq_t *handle, snd_seq_event_t *ev )
+{
+	sent++;
+
+	return 0;
+}
+
+/**
+ * Load the input events in evemu recording /filename/. Returns the number
+ * read.
+ */
+static int
+load_events ( const char *filename )
+{
+	char line[ 256 ];
+	unsigned long sec, usec;
+	unsigned int type, code;
+	int value, n = 0;
+	FILE *fp;
+
+	if ( ! ( fp = fopen( filename, "r" ) ) )
+	{
+		fprintf( stderr, "Couldn't open '%s'! (%s)\n", filename,
+				 strerror( errno ) );
+		exit( 1 );
+	}
+
+	while ( n < MAX_EVENTS && fgets( line, sizeof( line ), fp ) )
+		if ( sscanf( line, "E: %lu.%lu %x %x %i", &sec, &usec, &type, &code,
+					 &value ) == 5 )
+		{
+			events[ n ].type = type;
+			events[ n ].code = code;
+			events[ n ].value = value;
+			n++;
+		}
+
+	fclose( fp );
+
+	return n;
+}
+
+/**
+ * Add event /type/ /code/ /value/ and a report to the synthetic recording
+ */
+static void
+add ( int type, int code, int value )
+{
+	events[ nevents ].type = type;
+	events[ nevents ].code = code;
+	events[ nevents++ ].value = value;
+	events[ nevents ].type = EV_SYN;
+	events[ nevents ].code = SYN_REPORT;
+	events[ nevents++ ].value = 0;
+}
+
+/**
+ * Make up a recording of a pad being played: every button pressed and
+ * released while the sticks and triggers sweep, as a pad streams them.
+ */
+static int
+make_events ( void )
+{
+	static const int keys[] = {
+		BTN_NORTH, BTN_SOUTH, BTN_EAST, BTN_WEST, BTN_DPAD_UP,
+		BTN_DPAD_DOWN, BTN_DPAD_RIGHT, BTN_DPAD_LEFT, BTN_TR, BTN_TL,
+		BTN_TR2, BTN_TL2, BTN_THUMBR, BTN_THUMBL, BTN_SELECT, BTN_START
+	};
+	static const int axes[] = {
+		ABS_X, ABS_Y, ABS_RX, ABS_RY, ABS_Z, ABS_RZ
+	};
+	int i, v;
+
+	for ( i = 0; i < (int)( sizeof( keys ) / sizeof( keys[0] ) ); i++ )
+	{
+		add( EV_KEY, keys[ i ], DOWN );
+
+		for ( v = 0; v < 256; v += 16 )
+			add( EV_ABS, axes[ ( i + v ) % 6 ], v );
+
+		add( EV_KEY, keys[ i ], UP );
+	}
+
+	return nevents;
+}
+
+static int
+compare ( const void *a, const void *b )
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/** main
+ *
+ */
+int
+main ( int argc, char **argv )
+{
+	double ns[ ROUNDS ];
+	struct timespec a, b;
+	long i, n;
+	int r;
+
+	nevents = argc > 1 ? load_events( argv[ 1 ] ) : make_events();
+
+	if ( ! nevents )
+	{
+		fprintf( stderr, "No input events in '%s'!\n", argv[ 1 ] );
+		exit( 1 );
+	}
+
+	/* as one pad, no workers */
+	pads[ 0 ].fd = 0;
+
+	for ( r = 0; r < ROUNDS; r++ )
+	{
+		clock_gettime( CLOCK_MONOTONIC, &a );
+
+		for ( n = 0; n < BENCH_EVENTS; )
+			for ( i = 0; i < nevents; i++, n++ )
+				handle_event( &pads[ 0 ], &events[ i ] );
+
+		clock_gettime( CLOCK_MONOTONIC, &b );
+
+		ns[ r ] = ( ( b.tv_sec - a.tv_sec ) * 1e9 +
+					( b.tv_nsec - a.tv_nsec ) ) / n;
+	}
+
+	qsort( ns, ROUNDS, sizeof( ns[0] ), compare );
+
+#ifdef FIXED_MAP
+	printf( "fixed (%s): ", MAP_NAME );
+#else
+	printf( "table: " );
+#endif
+
+	printf( "%i events, %.1f%% sent, median %.1fnS/event, best %.1fnS\n",
+			nevents, 100.0 * sent / ( (double)n * ROUNDS ),
+			ns[ ROUNDS / 2 ], ns[ 0 ] );
+
+	return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2007 Jonathan Moore Liles
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General
+ * Public License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* bench-split.c
+ *
+ * Linux Pseudo MIDI Input -- Output Thread Benchmark
+ *
+ * Measures input to output latency through the drivers' own send path, with
+ * and without -T (the output thread). A device thread plays chords into a
+ * pipe, the main thread reads and "decodes" them as a driver would, and
+ * snd_seq_event_output_direct() is replaced by a write that blocks for a
+ * while, and now and then for much longer, as a write to a busy client
+ * does. Latency runs from when the device produced the event, so time spent
+ * waiting to be read counts too, which -S can't see.
+ *
+ * 	bench-split [-T] [write_uS [decode_uS]]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/prctl.h>
+#include <linux/input.h>
+#include <alsa/asoundlib.h>
+
+#include "seq.h"
+#include "rt.h"
+
+#define EVENTS 20000
+#define CHORD 6										/* events at once */
+#define PERIOD 5000									/* uS between chords */
+#define STALL 2000									/* uS a busy client blocks for */
+#define STALL_EVERY 500								/* writes */
+
+snd_seq_t *seq;
+int port = 0;
+int verbose = 0;
+
+static int write_us = 50;
+static int decode_us = 50;
+
+static double produced[ EVENTS ];
+static double latency[ EVENTS ];
+static int written;
+
+static int pfd[ 2 ];
+
+/**
+ * Return the time in uS
+ */
+static double
+now ( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Stands in for the sequencer: blocks, then notes the event's latency. The
+ * event's value is its index.
+ */
+int
+snd_seq_event_output_direct ( snd_seq_t *handle, snd_seq_event_t *ev )
+{
+	struct timespec ts;
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = write_us * 1000;
+
+	clock_nanosleep( CLOCK_MONOTONIC, 0, &ts, NULL );
+
+	if ( ( written + 1 ) % STALL_EVERY == 0 )
+		usleep( STALL );
+
+	latency[ written++ ] = now() - produced[ ev->data.control.value ];
+
+	return 0;
+}
+
+/**
+ * Device thread. Plays chords into the pipe.
+ */
+static void *
+device ( void *arg )
+{
+	struct input_event iev;
+	double next = now();
+	int i = 0, k;
+
+	memset( &iev, 0, sizeof( iev ) );
+
+	while ( i < EVENTS )
+	{
+		next += PERIOD;
+
+		while ( now() < next )
+			usleep( 50 );
+
+		for ( k = 0; k < CHORD && i < EVENTS; k++, i++ )
+		{
+			produced[ i ] = now();
+			iev.value = i;
+			write( pfd[ 1 ], &iev, sizeof( iev ) );
+		}
+	}
+
+	close( pfd[ 1 ] );
+
+	return NULL;
+}
+
+/**
+ * Spend /us/ on the CPU, as decoding an event might.
+ */
+static void
+decode ( int us )
+{
+	double end = now() + us;
+
+	while ( now() < end )
+		;
+}
+
+static int
+compare ( const void *a, const void *b )
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* sig.c wants one */
+void
+die ( int sig )
+{
+	exit( 0 );
+}
+
+/** main
+ *
+ */
+int
+main ( int argc, char **argv )
+{
+	struct input_event iev;
+	snd_seq_event_t ev;
+	pthread_t thread;
+	int a = 1;
+
+	if ( a < argc && ! strcmp( argv[ a ], "-T" ) )
+	{
+		threaded_output = 1;
+		a++;
+	}
+
+	if ( a < argc )
+		write_us = atoi( argv[ a++ ] );
+	if ( a < argc )
+		decode_us = atoi( argv[ a++ ] );
+
+	/* as -a 0 -O 1 would, where there are CPUs to do it */
+	if ( sysconf( _SC_NPROCESSORS_ONLN ) > 1 )
+	{
+		rt_pin( 0 );
+		output_cpu = 1;
+	}
+
+	/* so that short sleeps are short */
+	prctl( PR_SET_TIMERSLACK, 1 );
+
+	if ( pipe( pfd ) < 0 || start_output_thread() < 0 )
+		exit( 1 );
+
+	pthread_create( &thread, NULL, device, NULL );
+
+	while ( rt_read( pfd[ 0 ], &iev, sizeof( iev ) ) == sizeof( iev ) )
+	{
+		decode( decode_us );
+
+		snd_seq_ev_clear( &ev );
+		snd_seq_ev_set_controller( &ev, 0, 1, iev.value );
+		send_event( &ev );
+	}
+
+	stop_output_thread();
+
+	pthread_join( thread, NULL );
+
+	qsort( latency, written, sizeof( latency[0] ), compare );
+
+	printf( "%-14s write %iuS, decode %iuS: p50 %.0fuS, p99 %.0fuS, max %.0fuS\n",
+			threaded_output ? "split (-T)" : "single thread", write_us, decode_us,
+			latency[ written / 2 ], latency[ written * 99 / 100 ],
+			latency[ written - 1 ] );
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+#include "cache.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+char *cache_file = NULL;							/* NULL == don't cache */
+
+/**
+ * Fold /len/ bytes at /p/ into hash /h/ (FNV-1a)
+ */
+uint64_t
+cache_hash ( uint64_t h, const void *p, size_t len )
+{
+	const unsigned char *b = p;
+
+	while ( len-- )
+	{
+		h ^= *b++;
+		h *= FNV_PRIME;
+	}
+
+	return h;
+}
+
+/**
+ * Key for a configuration compiled from the /nargs/ option arguments in
+ * /args/ (NULL where not given) for the input device open on /fd/ (or none,
+ * if -1). Pass only the options that go into the configuration, so that,
+ * say, -v or -S doesn't mean compiling again. A different device in the same
+ * slot, or any change of those arguments, gives a different key.
+ */
+uint64_t
+cache_key ( char **args, int nargs, int fd )
+{
+	uint64_t h = FNV_OFFSET;
+	int i;
+
+	for ( i = 0; i < nargs; i++ )
+		h = args[ i ] ? cache_hash( h, args[ i ], strlen( args[ i ] ) + 1 ) :
+			cache_hash( h, "", 1 );
+
+	if ( fd >= 0 )
+	{
+		struct input_id id;
+		char name[ 256 ];
+
+		memset( &id, 0, sizeof( id ) );
+		memset( name, 0, sizeof( name ) );
+
+		ioctl( fd, EVIOCGID, &id );
+		ioctl( fd, EVIOCGNAME( sizeof( name ) ), name );
+
+		h = cache_hash( h, &id, sizeof( id ) );
+		h = cache_hash( h, name, strlen( name ) );
+	}
+
+	return h;
+}
+
+/**
+ * Map the cache file and return its /size/ bytes of configuration if they
+ * were compiled under /key/, or NULL if they need compiling (again).
+ */
+const void *
+cache_load ( uint64_t key, size_t size )
+{
+	const struct cache_hdr *c;
+	struct stat st;
+	int cfd;
+
+	if ( ! cache_file )
+		return NULL;
+
+	if ( -1 == ( cfd = open( cache_file, O_RDONLY ) ) )
+		return NULL;
+
+	if ( fstat( cfd, &st ) < 0 || st.st_size != (off_t)( sizeof( *c ) + size ) )
+	{
+		close( cfd );
+		return NULL;
+	}
+
+	c = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, cfd, 0 );
+
+	close( cfd );
+
+	if ( c == MAP_FAILED )
+		return NULL;
+
+	if ( c->magic != CACHE_MAGIC || c->version != CACHE_VERSION ||
+		 c->key != key || c->size != size )
+	{
+		munmap( (void *)c, st.st_size );
+		return NULL;
+	}
+
+	fprintf( stderr, "Using compiled configuration from '%s'.\n", cache_file );
+
+	return c + 1;
+}
+
+/**
+ * Store /size/ bytes of configuration at /data/, compiled under /key/. The
+ * file is replaced in one go, so a reader never sees half of it. It isn't
+ * synced: a cache lost to a power cut fails the size or key check and is
+ * simply compiled again.
+ */
+void
+cache_save ( uint64_t key, const void *data, size_t size )
+{
+	struct cache_hdr c;
+	char tmp[ 300 ];
+	FILE *fp;
+	int failed;
+
+	if ( ! cache_file )
+		return;
+
+	c.magic = CACHE_MAGIC;
+	c.version = CACHE_VERSION;
+	c.key = key;
+	c.size = size;
+
+	snprintf( tmp, sizeof( tmp ), "%s.tmp", cache_file );
+
+	if ( ! ( fp = fopen( tmp, "w" ) ) )
+	{
+		fprintf( stderr, "Couldn't write '%s'! (%s)\n", tmp, strerror( errno ) );
+		return;
+	}
+
+	failed = fwrite( &c, sizeof( c ), 1, fp ) != 1 ||
+		fwrite( data, size, 1, fp ) != 1;
+
+	failed |= fclose( fp ) != 0;
+
+	if ( failed || rename( tmp, cache_file ) < 0 )
+	{
+		fprintf( stderr, "Couldn't write '%s'! (%s)\n", cache_file,
+				 strerror( errno ) );
+		unlink( tmp );
+		return;
+	}
+
+	fprintf( stderr, "Compiled configuration into '%s'.\n", cache_file );
+}
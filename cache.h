@@ -0,0 +1,19 @@
+
+#define CACHE_MAGIC 0x434d534c						/* "LSMC" */
+#define CACHE_VERSION 1
+
+/* Compiled configuration: whatever a driver worked out from its arguments,
+ * databases and device, so the next start can skip straight to it. */
+struct cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;									/* what it was compiled from */
+	uint32_t size;									/* of what follows */
+};
+
+extern char *cache_file;
+
+uint64_t cache_hash __P(( uint64_t h, const void *p, size_t len ));
+uint64_t cache_key __P(( char **args, int nargs, int fd ));
+const void * cache_load __P(( uint64_t key, size_t size ));
+void cache_save __P(( uint64_t key, const void *data, size_t size ));
@@ -0,0 +1,458 @@
+/*
+ * Copyright (C) 2007 Jonathan Moore Liles
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General
+ * Public License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* check-net.c
+ *
+ * Linux Pseudo MIDI Input -- Network Loopback Check
+ *
+ * Makes up a uinput device, runs lsmi-forward on it to 127.0.0.1, and reads
+ * what arrives through the drivers' own udp: source (net.c). In between sits
+ * a relay that can drop datagrams on the way to the driver, so a lost press
+ * and a lost release can be staged, and the resync that should follow
+ * checked: after it the driver must hold exactly what the device does. Needs
+ * write access to /dev/uinput.
+ *
+ * 	check-net [path to lsmi-forward]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+
+#include "net.h"
+
+#define WAIT 2000									/* for anything to arrive, in mS */
+
+int ufd = -1;										/* the made up device */
+int src = -1;										/* the driver's end */
+int rfd = -1;										/* the relay */
+pid_t forwarder;
+
+struct sockaddr_in driver_addr;
+
+/* relay state, shared with the relay thread */
+int drop;											/* datagrams still to lose */
+int relayed;
+int resyncs;
+
+/* what the driver has been told is held */
+unsigned char held[ KEY_CNT ];
+int32_t axis[ ABS_CNT ];
+
+int failures;
+
+/**
+ * Kill the forwarder and destroy the device, however we leave
+ */
+void
+cleanup ( void )
+{
+	if ( forwarder > 0 )
+	{
+		kill( forwarder, SIGTERM );
+		waitpid( forwarder, NULL, 0 );
+		forwarder = 0;
+	}
+
+	if ( ufd >= 0 )
+	{
+		ioctl( ufd, UI_DEV_DESTROY );
+		close( ufd );
+		ufd = -1;
+	}
+}
+
+/**
+ * Milliseconds since some time or other
+ */
+long
+now_ms ( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Have the made up device report event /type/ /code/ /value/
+ */
+void
+emit ( int type, int code, int value )
+{
+	struct input_event iev;
+
+	memset( &iev, 0, sizeof( iev ) );
+
+	iev.type = type;
+	iev.code = code;
+	iev.value = value;
+
+	if ( write( ufd, &iev, sizeof( iev ) ) != sizeof( iev ) )
+	{
+		perror( "write uinput" );
+		exit( 1 );
+	}
+}
+
+/**
+ * Report event /type/ /code/ /value/ on its own
+ */
+void
+report ( int type, int code, int value )
+{
+	emit( type, code, value );
+	emit( EV_SYN, SYN_REPORT, 0 );
+}
+
+/**
+ * Make up a device with a few keys and an axis. Returns its event node in
+ * /node/.
+ */
+void
+make_device ( char *node, size_t len )
+{
+	static const int keys[] = { KEY_A, KEY_B, KEY_C, BTN_LEFT };
+	struct uinput_setup us;
+	struct uinput_abs_setup as;
+	char sysname[ 64 ], path[ 256 ];
+	struct dirent *de;
+	DIR *dir;
+	long start;
+	int i;
+
+	if ( -1 == ( ufd = open( "/dev/uinput", O_WRONLY | O_NONBLOCK ) ) )
+	{
+		fprintf( stderr, "Error opening /dev/uinput! (%s)\n", strerror( errno ) );
+		exit( 1 );
+	}
+
+	ioctl( ufd, UI_SET_EVBIT, EV_KEY );
+
+	for ( i = 0; i < (int)( sizeof( keys ) / sizeof( keys[0] ) ); i++ )
+		ioctl( ufd, UI_SET_KEYBIT, keys[ i ] );
+
+	ioctl( ufd, UI_SET_EVBIT, EV_ABS );
+	ioctl( ufd, UI_SET_ABSBIT, ABS_X );
+
+	memset( &as, 0, sizeof( as ) );
+	as.code = ABS_X;
+	as.absinfo.maximum = 255;
+
+	memset( &us, 0, sizeof( us ) );
+	us.id.bustype = BUS_VIRTUAL;
+	snprintf( us.name, sizeof( us.name ), "lsmi loopback check" );
+
+	if ( ioctl( ufd, UI_ABS_SETUP, &as ) ||
+		 ioctl( ufd, UI_DEV_SETUP, &us ) ||
+		 ioctl( ufd, UI_DEV_CREATE ) ||
+		 ioctl( ufd, UI_GET_SYSNAME( sizeof( sysname ) ), sysname ) < 0 )
+	{
+		perror( "uinput" );
+		exit( 1 );
+	}
+
+	snprintf( path, sizeof( path ), "/sys/devices/virtual/input/%s", sysname );
+
+	*node = '\0';
+
+	if ( ( dir = opendir( path ) ) )
+	{
+		while ( ( de = readdir( dir ) ) )
+			if ( ! strncmp( de->d_name, "event", 5 ) )
+				snprintf( node, len, "/dev/input/%s", de->d_name );
+
+		closedir( dir );
+	}
+
+	if ( ! *node )
+	{
+		fprintf( stderr, "No event node for '%s'!\n", path );
+		exit( 1 );
+	}
+
+	/* udev may take a moment over it */
+	for ( start = now_ms(); access( node, R_OK ); usleep( 10000 ) )
+		if ( now_ms() - start > WAIT )
+		{
+			fprintf( stderr, "'%s' never turned up!\n", node );
+			exit( 1 );
+		}
+}
+
+/**
+ * Bind a UDP socket to an unused port on 127.0.0.1. Returns the socket and
+ * its address in /sin/.
+ */
+int
+loopback_socket ( struct sockaddr_in *sin )
+{
+	socklen_t len = sizeof( *sin );
+	int s;
+
+	memset( sin, 0, sizeof( *sin ) );
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+	if ( -1 == ( s = socket( AF_INET, SOCK_DGRAM, 0 ) ) ||
+		 bind( s, (struct sockaddr *)sin, sizeof( *sin ) ) < 0 ||
+		 getsockname( s, (struct sockaddr *)sin, &len ) < 0 )
+	{
+		perror( "socket" );
+		exit( 1 );
+	}
+
+	return s;
+}
+
+/**
+ * Relay thread: pass datagrams from the forwarder to the driver, losing
+ * the next /drop/ of them, and resync requests from the driver back.
+ */
+void *
+relay ( void *arg )
+{
+	struct sockaddr_in from, fwd;
+	struct net_packet p;
+	socklen_t len;
+	int have_fwd = 0;
+	ssize_t n;
+
+	for ( ;; )
+	{
+		len = sizeof( from );
+
+		if ( ( n = recvfrom( rfd, &p, sizeof( p ), 0, (struct sockaddr *)&from,
+							 &len ) ) < 0 )
+			continue;
+
+		if ( from.sin_port == driver_addr.sin_port )
+		{
+			if ( have_fwd )
+				sendto( rfd, &p, n, 0, (struct sockaddr *)&fwd, sizeof( fwd ) );
+
+			__atomic_add_fetch( &resyncs, 1, __ATOMIC_SEQ_CST );
+			continue;
+		}
+
+		fwd = from;
+		have_fwd = 1;
+
+		__atomic_add_fetch( &relayed, 1, __ATOMIC_SEQ_CST );
+
+		if ( __atomic_load_n( &drop, __ATOMIC_SEQ_CST ) > 0 )
+		{
+			__atomic_sub_fetch( &drop, 1, __ATOMIC_SEQ_CST );
+			continue;
+		}
+
+		sendto( rfd, &p, n, 0, (struct sockaddr *)&driver_addr,
+				sizeof( driver_addr ) );
+	}
+
+	return NULL;
+}
+
+/**
+ * Start lsmi-forward at /path/ on /node/, sending to the relay at /sin/
+ */
+void
+start_forwarder ( const char *path, const char *node, struct sockaddr_in *sin )
+{
+	char dest[ 64 ];
+	long start;
+
+	snprintf( dest, sizeof( dest ), "127.0.0.1:%u", ntohs( sin->sin_port ) );
+
+	switch ( forwarder = fork() )
+	{
+		case -1:
+			perror( "fork" );
+			exit( 1 );
+		case 0:
+			/* no idle snapshots; only a resync may put things right */
+			execl( path, path, "-d", node, "-s", dest, "-i", "60000",
+				   (char *)NULL );
+			fprintf( stderr, "Couldn't run '%s'! (%s)\n", path, strerror( errno ) );
+			_exit( 1 );
+	}
+
+	/* the first snapshot says it's running */
+	for ( start = now_ms(); ! __atomic_load_n( &relayed, __ATOMIC_SEQ_CST );
+		  usleep( 10000 ) )
+		if ( now_ms() - start > WAIT || waitpid( forwarder, NULL, WNOHANG ) )
+		{
+			fprintf( stderr, "Nothing from lsmi-forward!\n" );
+			forwarder = 0;
+			exit( 1 );
+		}
+}
+
+/**
+ * Read what the driver would, until a SYN_REPORT, keeping track of what it
+ * has been told. Returns 0 if nothing came within WAIT.
+ */
+int
+receive ( void )
+{
+	struct input_event iev;
+	struct pollfd pfd;
+	long start = now_ms();
+
+	pfd.fd = src;
+	pfd.events = POLLIN;
+
+	while ( now_ms() - start < WAIT )
+	{
+		if ( ! net_pending( src ) && poll( &pfd, 1, 10 ) <= 0 )
+			continue;
+
+		/* non-blocking, so a datagram that yields nothing doesn't hang us */
+		if ( net_read( src, &iev, sizeof( iev ) ) != sizeof( iev ) )
+			continue;
+
+		if ( iev.type == EV_KEY && iev.code < KEY_CNT )
+			held[ iev.code ] = iev.value != 0;
+		else
+		if ( iev.type == EV_ABS && iev.code < ABS_CNT )
+			axis[ iev.code ] = iev.value;
+		else
+		if ( iev.type == EV_SYN && iev.code == SYN_REPORT )
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Record check /what/ as passed or failed according to /ok/
+ */
+void
+check ( const char *what, int ok )
+{
+	printf( "%-50s %s\n", what, ok ? "ok" : "FAILED" );
+
+	if ( ! ok )
+		failures++;
+}
+
+/** main
+ *
+ */
+int
+main ( int argc, char **argv )
+{
+	const char *path = argc > 1 ? argv[ 1 ] : "./lsmi-forward";
+	struct sockaddr_in relay_addr;
+	char node[ 256 ];
+	pthread_t th;
+	int r;
+
+	atexit( cleanup );
+
+	make_device( node, sizeof( node ) );
+
+	if ( -1 == ( src = net_open( "udp:127.0.0.1:0" ) ) )
+		exit( 1 );
+
+	{
+		socklen_t len = sizeof( driver_addr );
+
+		getsockname( src, (struct sockaddr *)&driver_addr, &len );
+		fcntl( src, F_SETFL, O_NONBLOCK );
+	}
+
+	rfd = loopback_socket( &relay_addr );
+
+	pthread_create( &th, NULL, relay, NULL );
+
+	start_forwarder( path, node, &relay_addr );
+
+	/* straight through */
+	report( EV_KEY, KEY_A, 1 );
+	check( "press arrives", receive() && held[ KEY_A ] );
+
+	report( EV_ABS, ABS_X, 100 );
+	check( "axis arrives", receive() && axis[ ABS_X ] == 100 );
+
+	report( EV_KEY, KEY_A, 0 );
+	check( "release arrives", receive() && ! held[ KEY_A ] );
+
+	/* a lost press: the next report shows the gap, and the snapshot asked
+	 * for presses what was missed */
+	__atomic_store_n( &drop, 1, __ATOMIC_SEQ_CST );
+	report( EV_KEY, KEY_B, 1 );
+	report( EV_KEY, KEY_C, 1 );
+
+	r = __atomic_load_n( &resyncs, __ATOMIC_SEQ_CST );
+
+	while ( receive() && ! held[ KEY_B ] )
+		;
+
+	check( "lost press asks for a resync",
+		   __atomic_load_n( &resyncs, __ATOMIC_SEQ_CST ) > r );
+	check( "resync presses the lost key", held[ KEY_B ] && held[ KEY_C ] );
+	check( "resync leaves the axis alone", axis[ ABS_X ] == 100 );
+
+	/* a lost release: the hanging note a resync is for */
+	__atomic_store_n( &drop, 1, __ATOMIC_SEQ_CST );
+	report( EV_KEY, KEY_B, 0 );
+	report( EV_KEY, KEY_C, 0 );
+
+	r = __atomic_load_n( &resyncs, __ATOMIC_SEQ_CST );
+
+	while ( receive() && held[ KEY_B ] )
+		;
+
+	check( "lost release asks for a resync",
+		   __atomic_load_n( &resyncs, __ATOMIC_SEQ_CST ) > r );
+	check( "resync releases the lost key", ! held[ KEY_B ] && ! held[ KEY_C ] );
+
+	/* and carries on as before */
+	report( EV_KEY, BTN_LEFT, 1 );
+	check( "stream carries on after a resync", receive() && held[ BTN_LEFT ] );
+	report( EV_KEY, BTN_LEFT, 0 );
+	receive();
+
+	net_report();
+
+	printf( "%s\n", failures ? "FAILED" : "All passed." );
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,545 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+
+#include "seq.h"
+#include "rec.h"
+#include "ctl.h"
+#include "quant.h"
+
+/* don't let a latency storm turn into a storm of dumps */
+#define AUTO_HOLDOFF 10								/* in seconds */
+
+#define HANDOVER_MAGIC 0x4f444e48					/* "HNDO" */
+#define PARK_TIMEOUT 1000							/* in milliseconds */
+#define CONFIRM_TIMEOUT 5000						/* in milliseconds */
+
+/* what goes to our successor (alongside the fds) */
+struct handover {
+	uint32_t magic;
+	uint32_t nfds;
+	uint32_t len;
+	uint32_t nsubs;
+	snd_seq_addr_t subs[ CTL_MAX_SUBS ];
+	unsigned char state[ CTL_MAX_STATE ];
+};
+
+char *ctl_path = NULL;								/* control socket */
+
+static int lfd = -1;
+static pthread_t ctl_thread;
+
+/* offered for handover by the driver */
+static int offer_fds[ CTL_MAX_FDS ];
+static int offer_nfds = 0;
+static void *offer_state;
+static size_t offer_len;
+static pthread_t main_thread;
+
+volatile int ctl_parking = 0;						/* main thread to park */
+static int parked_efd = -1;							/* main -> control */
+static int resume_efd = -1;							/* control -> main */
+static int output_stopped = 0;
+
+static int predecessor = -1;						/* connection to confirm on */
+
+/**
+ * SIGUSR1 handler
+ */
+static void
+dump_signal ( int sig )
+{
+	rec_trigger( 0 );
+}
+
+/**
+ * Dump the flight recorder to /filename/ (or a new file), reporting the
+ * result to /cfd/ if it's a control connection.
+ */
+static void
+dump ( const char *filename, int cfd )
+{
+	char name[ 256 ];
+	char reply[ 300 ];
+
+	if ( rec_dump( filename, name, sizeof( name ) ) < 0 )
+		snprintf( reply, sizeof( reply ), "error %s: %s\n", name,
+				  strerror( errno ) );
+	else
+		snprintf( reply, sizeof( reply ), "ok %s\n", name );
+
+	fprintf( stderr, "Flight recorder: %s", reply );
+
+	if ( cfd >= 0 )
+		write( cfd, reply, strlen( reply ) );
+}
+
+/**
+ * Write /msg/ to control connection /cfd/
+ */
+static void
+reply ( int cfd, const char *msg )
+{
+	write( cfd, msg, strlen( msg ) );
+}
+
+/**
+ * SIGUSR2 handler. Does nothing but interrupt the main thread's read.
+ */
+static void
+park_signal ( int sig )
+{
+}
+
+/**
+ * Park the calling (main) thread until the control thread lets it go. Called
+ * from the event loop wrappers when /ctl_parking/ is set.
+ */
+void
+ctl_park ( void )
+{
+	uint64_t v = 1;
+
+	write( parked_efd, &v, sizeof( v ) );
+
+	while ( read( resume_efd, &v, sizeof( v ) ) < 0 )
+		;
+
+	/* handover failed; carry on as before */
+	if ( output_stopped )
+	{
+		output_stopped = 0;
+		start_output_thread();
+	}
+}
+
+/**
+ * Let a parked main thread go
+ */
+static void
+resume ( void )
+{
+	uint64_t v = 1;
+
+	__atomic_store_n( &ctl_parking, 0, __ATOMIC_RELEASE );
+
+	write( resume_efd, &v, sizeof( v ) );
+}
+
+/**
+ * Hand our devices, state and subscribers to the process on the other end
+ * of control connection /cfd/, and exit once it confirms. The main thread is
+ * parked first, so nothing is read or sent while the two overlap. /arg/ is
+ * the number of fds and bytes of state the successor expects, if it said;
+ * if those aren't what we have it can't take over, so we don't stop.
+ */
+static void
+handover ( int cfd, const char *arg )
+{
+	struct handover h;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	char cbuf[ CMSG_SPACE( sizeof( int ) * CTL_MAX_FDS ) ];
+	struct pollfd pfd;
+	char buf[ 16 ];
+	int i;
+
+	if ( ! offer_nfds )
+	{
+		reply( cfd, "error handover not supported\n" );
+		return;
+	}
+
+	if ( arg )
+	{
+		unsigned int nfds, len;
+
+		if ( sscanf( arg, "%u %u", &nfds, &len ) == 2 &&
+			 ( nfds != (unsigned int)offer_nfds || len != offer_len ) )
+		{
+			reply( cfd, "error different kind of driver\n" );
+			return;
+		}
+	}
+
+	__atomic_store_n( &ctl_parking, 1, __ATOMIC_RELEASE );
+
+	pfd.fd = parked_efd;
+	pfd.events = POLLIN;
+
+	/* keep poking in case the signal lands between the check and the read */
+	for ( i = 0; i < PARK_TIMEOUT / 10; i++ )
+	{
+		pthread_kill( main_thread, SIGUSR2 );
+
+		if ( poll( &pfd, 1, 10 ) > 0 )
+			break;
+	}
+
+	if ( i == PARK_TIMEOUT / 10 )
+	{
+		__atomic_store_n( &ctl_parking, 0, __ATOMIC_RELEASE );
+		reply( cfd, "error busy\n" );
+		return;
+	}
+
+	{
+		uint64_t v;
+
+		read( parked_efd, &v, sizeof( v ) );
+	}
+
+	/* get everything already played out, and leave nothing hanging */
+	if ( threaded_output )
+	{
+		stop_output_thread();
+		output_stopped = 1;
+	}
+
+	quant_flush();
+
+	release_notes();
+
+	memset( &h, 0, sizeof( h ) );
+
+	h.magic = HANDOVER_MAGIC;
+	h.nfds = offer_nfds;
+	h.len = offer_len;
+	h.nsubs = get_subscribers( h.subs, CTL_MAX_SUBS );
+
+	memcpy( h.state, offer_state, offer_len );
+
+	iov.iov_base = &h;
+	iov.iov_len = sizeof( h );
+
+	memset( &msg, 0, sizeof( msg ) );
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = CMSG_SPACE( sizeof( int ) * offer_nfds );
+
+	cm = CMSG_FIRSTHDR( &msg );
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN( sizeof( int ) * offer_nfds );
+	memcpy( CMSG_DATA( cm ), offer_fds, sizeof( int ) * offer_nfds );
+
+	pfd.fd = cfd;
+
+	if ( sendmsg( cfd, &msg, 0 ) == sizeof( h ) &&
+		 poll( &pfd, 1, CONFIRM_TIMEOUT ) > 0 &&
+		 read( cfd, buf, sizeof( buf ) ) >= 2 &&
+		 ! strncmp( buf, "ok", 2 ) )
+	{
+		fprintf( stderr, "Handed over to successor.\n" );
+
+		/* no ungrab, no UI_DEV_DESTROY; the devices live on over there */
+		_exit( 0 );
+	}
+
+	fprintf( stderr, "Successor didn't confirm handover, resuming.\n" );
+
+	resume();
+}
+
+/**
+ * Serve one command from control connection /cfd/
+ */
+static void
+command ( int cfd )
+{
+	char buf[ 256 ];
+	char *arg;
+	ssize_t n;
+
+	if ( ( n = read( cfd, buf, sizeof( buf ) - 1 ) ) <= 0 )
+		return;
+
+	buf[ n ] = '\0';
+	buf[ strcspn( buf, "\r\n" ) ] = '\0';
+
+	if ( ( arg = strchr( buf, ' ' ) ) )
+		*arg++ = '\0';
+
+	if ( ! strcmp( buf, "dump" ) )
+		dump( arg && *arg ? arg : NULL, cfd );
+	else
+	if ( ! strcmp( buf, "handover" ) )
+		handover( cfd, arg && *arg ? arg : NULL );
+	else
+		reply( cfd, "error unknown command\n" );
+}
+
+/**
+ * Control thread. Waits for dump requests (signal, latency threshold) and
+ * control connections.
+ */
+static void *
+ctl_loop ( void *arg )
+{
+	struct pollfd pfd[ 2 ];
+	time_t last_auto = 0;
+
+	pfd[ 0 ].fd = rec_efd;
+	pfd[ 0 ].events = POLLIN;
+	pfd[ 1 ].fd = lfd;
+	pfd[ 1 ].events = POLLIN;
+
+	for ( ;; )
+	{
+		int automatic;
+
+		if ( poll( pfd, 2, -1 ) <= 0 )
+			continue;
+
+		if ( ( pfd[ 0 ].revents & POLLIN ) && rec_pending( &automatic ) )
+		{
+			time_t now = time( NULL );
+
+			if ( ! automatic )
+				dump( NULL, -1 );
+			else
+			if ( now - last_auto >= AUTO_HOLDOFF )
+			{
+				fprintf( stderr, "Latency over %liuS!\n", rec_threshold );
+				dump( NULL, -1 );
+				last_auto = now;
+			}
+		}
+
+		if ( pfd[ 1 ].revents & POLLIN )
+		{
+			int cfd;
+
+			if ( ( cfd = accept( lfd, NULL, NULL ) ) >= 0 )
+			{
+				command( cfd );
+				close( cfd );
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Start the control thread, listening on /ctl_path/ if one was given, and
+ * route SIGUSR1 to the flight recorder. Call after set_traps().
+ */
+int
+ctl_start ( void )
+{
+	struct sched_param sp;
+	pthread_attr_t attr;
+
+	if ( rec_init() < 0 )
+	{
+		fprintf( stderr, "Error starting flight recorder! (%s)\n",
+				 strerror( errno ) );
+		return -1;
+	}
+
+	signal( SIGUSR1, dump_signal );
+
+	if ( ctl_path )
+	{
+		struct sockaddr_un sa;
+
+		memset( &sa, 0, sizeof( sa ) );
+		sa.sun_family = AF_UNIX;
+		snprintf( sa.sun_path, sizeof( sa.sun_path ), "%s", ctl_path );
+
+		unlink( ctl_path );
+
+		if ( -1 == ( lfd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) ||
+			 bind( lfd, (struct sockaddr *)&sa, sizeof( sa ) ) < 0 ||
+			 listen( lfd, 4 ) < 0 )
+		{
+			fprintf( stderr, "Error creating control socket '%s'! (%s)\n",
+					 ctl_path, strerror( errno ) );
+			return -1;
+		}
+
+		fprintf( stderr, "Listening for commands on '%s'.\n", ctl_path );
+	}
+
+	/* housekeeping; keep it out of the realtime class */
+	sp.sched_priority = 0;
+
+	pthread_attr_init( &attr );
+	pthread_attr_setinheritsched( &attr, PTHREAD_EXPLICIT_SCHED );
+	pthread_attr_setschedpolicy( &attr, SCHED_OTHER );
+	pthread_attr_setschedparam( &attr, &sp );
+
+	if ( pthread_create( &ctl_thread, &attr, ctl_loop, NULL ) )
+	{
+		fprintf( stderr, "Error starting control thread!\n" );
+		return -1;
+	}
+
+	pthread_attr_destroy( &attr );
+
+	return 0;
+}
+
+/**
+ * Remove control socket
+ */
+void
+ctl_stop ( void )
+{
+	if ( lfd >= 0 && ctl_path )
+		unlink( ctl_path );
+}
+
+/**
+ * Offer /nfds/ file descriptors and /len/ bytes of /state/ to a successor
+ * that asks for a handover. Call from the main thread after set_traps(); the
+ * main thread must do all its reading through rt_read() or rt_select().
+ */
+void
+ctl_offer ( int *fds, int nfds, void *state, size_t len )
+{
+	struct sigaction sa;
+
+	if ( nfds > CTL_MAX_FDS || len > CTL_MAX_STATE )
+	{
+		fprintf( stderr, "Too much to hand over!\n" );
+		return;
+	}
+
+	if ( -1 == ( parked_efd = eventfd( 0, 0 ) ) ||
+		 -1 == ( resume_efd = eventfd( 0, 0 ) ) )
+	{
+		fprintf( stderr, "Error setting up handover! (%s)\n",
+				 strerror( errno ) );
+		return;
+	}
+
+	/* no SA_RESTART, so a blocking read returns EINTR */
+	memset( &sa, 0, sizeof( sa ) );
+	sa.sa_handler = park_signal;
+	sigemptyset( &sa.sa_mask );
+	sigaction( SIGUSR2, &sa, NULL );
+
+	memcpy( offer_fds, fds, sizeof( int ) * nfds );
+	offer_state = state;
+	offer_len = len;
+	main_thread = pthread_self();
+
+	__atomic_store_n( &offer_nfds, nfds, __ATOMIC_RELEASE );
+}
+
+/**
+ * Take over from the driver listening on control socket /path/. Fills in
+ * /nfds/ /fds/ and /len/ bytes of /state/, and subscribes our output port to
+ * whatever the old one was feeding, so the sequencer must be open. The old
+ * driver is parked until ctl_confirm() is called.
+ */
+int
+ctl_takeover ( const char *path, int *fds, int nfds, void *state, size_t len )
+{
+	struct sockaddr_un sa;
+	struct handover h;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	char cbuf[ CMSG_SPACE( sizeof( int ) * CTL_MAX_FDS ) ];
+	struct pollfd pfd;
+	ssize_t n;
+
+	memset( &sa, 0, sizeof( sa ) );
+	sa.sun_family = AF_UNIX;
+	snprintf( sa.sun_path, sizeof( sa.sun_path ), "%s", path );
+
+	if ( -1 == ( predecessor = socket( AF_UNIX, SOCK_STREAM, 0 ) ) ||
+		 connect( predecessor, (struct sockaddr *)&sa, sizeof( sa ) ) < 0 )
+	{
+		fprintf( stderr, "Error connecting to '%s'! (%s)\n", path,
+				 strerror( errno ) );
+		return -1;
+	}
+
+	{
+		char req[ 64 ];
+
+		/* so it can refuse before stopping if we couldn't carry on */
+		snprintf( req, sizeof( req ), "handover %i %lu\n", nfds,
+				  (unsigned long)len );
+
+		reply( predecessor, req );
+	}
+
+	iov.iov_base = &h;
+	iov.iov_len = sizeof( h );
+
+	memset( &msg, 0, sizeof( msg ) );
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof( cbuf );
+
+	pfd.fd = predecessor;
+	pfd.events = POLLIN;
+
+	if ( poll( &pfd, 1, PARK_TIMEOUT + CONFIRM_TIMEOUT ) <= 0 ||
+		 ( n = recvmsg( predecessor, &msg, MSG_WAITALL ) ) <= 0 )
+	{
+		fprintf( stderr, "No reply to handover request!\n" );
+		return -1;
+	}
+
+	if ( n != sizeof( h ) || h.magic != HANDOVER_MAGIC )
+	{
+		/* probably an error message; show it */
+		fprintf( stderr, "Handover refused: %.*s", (int)n, (char *)&h );
+		return -1;
+	}
+
+	cm = CMSG_FIRSTHDR( &msg );
+
+	if ( h.nfds != nfds || h.len != len || ! cm ||
+		 cm->cmsg_type != SCM_RIGHTS ||
+		 cm->cmsg_len != CMSG_LEN( sizeof( int ) * nfds ) )
+	{
+		fprintf( stderr, "Handover from a different kind of driver!\n" );
+		return -1;
+	}
+
+	memcpy( fds, CMSG_DATA( cm ), sizeof( int ) * nfds );
+	memcpy( state, h.state, len );
+
+	fprintf( stderr, "Took over %i device(s), %i subscription(s) carried over.\n",
+			 nfds, subscribe_to( h.subs, h.nsubs ) );
+
+	return 0;
+}
+
+/**
+ * Tell the driver we took over from that it can go. Call when ready to read.
+ */
+void
+ctl_confirm ( void )
+{
+	if ( predecessor < 0 )
+		return;
+
+	reply( predecessor, "ok\n" );
+
+	close( predecessor );
+	predecessor = -1;
+}
@@ -0,0 +1,14 @@
+
+#define CTL_MAX_FDS 4
+#define CTL_MAX_STATE 256
+#define CTL_MAX_SUBS 32
+
+extern char *ctl_path;
+extern volatile int ctl_parking;
+
+int ctl_start __P(( void ));
+void ctl_stop __P(( void ));
+void ctl_offer __P(( int *fds, int nfds, void *state, size_t len ));
+void ctl_park __P(( void ));
+int ctl_takeover __P(( const char *path, int *fds, int nfds, void *state, size_t len ));
+void ctl_confirm __P(( void ));
@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2007 Jonathan Moore Liles
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General
+ * Public License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* lsmi-forward.c
+ *
+ * Linux Pseudo MIDI Input -- Network Forwarder
+ *
+ * This program grabs an input device on a small box somewhere on stage and
+ * sends its events, one UDP datagram per report, to the box running the
+ * actual driver, which is given udp:port in place of a device. Nothing is
+ * decoded here, so it needs neither ALSA nor any idea of what the device is
+ * for. Each datagram is numbered and stamped; when the driver notices one
+ * went missing it asks for a snapshot of the device's state, and one is sent
+ * anyway when the device is idle, so nothing stays stuck for long.
+ *
+ * Example:
+ *
+ * 	On the pedalboard's box:
+ *
+ * 	lsmi-forward -d /dev/input/event4 -s mixhost:7400
+ *
+ * 	On mixhost:
+ *
+ * 	lsmi-mouse -d udp:7400 -1 c:1:64 -2 n:1:36 -3 n:1:37
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <endian.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <linux/input.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+
+#include <getopt.h>
+
+#include "net.h"
+
+#define VERSION "0.1"
+
+#define testbit(bit, array)    (array[bit/8] & (1<<(bit%8)))
+
+char defaultdevice[] = "/dev/input/event0";
+char *device = defaultdevice;
+char *host = NULL;
+int interval = 1000;								/* idle snapshots, in mS */
+int verbose = 0;
+
+int fd;												/* device */
+int sock;											/* to the driver */
+
+struct net_packet packet;
+uint32_t seq = 0;
+
+/** usage
+ *
+ * print help
+ *
+ */
+void
+usage ( void )
+{
+	fprintf( stderr, "Usage: lsmi-forward [options]\n"
+	"Options:\n\n"
+		" -h | --help                   Show this message\n"
+		" -d | --device specialfile     Event device to use (instead of event0)\n"
+		" -s | --send host:port         Send events to driver listening on udp:port on 'host'\n"
+		" -i | --interval mS            Send a snapshot after 'mS' of quiet (default 1000)\n"
+		" -v | --verbose                Be verbose (show datagrams)\n"
+	"\n" );
+}
+
+/**
+ * process commandline arguments
+ */
+void
+get_args ( int argc, char **argv )
+{
+	const char *short_opts = "hd:s:i:v";
+	const struct option long_opts[] =
+	{
+		{ "help", no_argument, NULL, 'h' },
+		{ "device", required_argument, NULL, 'd' },
+		{ "send", required_argument, NULL, 's' },
+		{ "interval", required_argument, NULL, 'i' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	int c;
+
+	while ( ( c = getopt_long( argc, argv, short_opts, long_opts, NULL ))
+			!= -1 )
+	{
+		switch (c)
+		{
+			case 'h':
+				usage();
+				exit(0);
+				break;
+			case 'd':
+				device = optarg;
+				break;
+			case 's':
+				host = optarg;
+				break;
+			case 'i':
+				interval = atoi( optarg );
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+		}
+	}
+
+	if ( ! host )
+	{
+		fprintf( stderr, "Where to? (-s host:port)\n" );
+		exit( 1 );
+	}
+}
+
+/**
+ * Open a UDP socket to /spec/ (host:port)
+ */
+int
+open_socket ( const char *spec )
+{
+	struct addrinfo hints, *ai;
+	char name[ 256 ];
+	char *service;
+	int s, err;
+
+	snprintf( name, sizeof( name ), "%s", spec );
+
+	if ( ! ( service = strrchr( name, ':' ) ) )
+	{
+		fprintf( stderr, "'%s' should be host:port!\n", spec );
+		return -1;
+	}
+
+	*service++ = '\0';
+
+	memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if ( ( err = getaddrinfo( name, service, &hints, &ai ) ) )
+	{
+		fprintf( stderr, "Can't find '%s'! (%s)\n", spec, gai_strerror( err ) );
+		return -1;
+	}
+
+	/* connected, so that only the driver can ask us for anything */
+	if ( -1 == ( s = socket( ai->ai_family, SOCK_DGRAM, 0 ) ) ||
+		 connect( s, ai->ai_addr, ai->ai_addrlen ) < 0 )
+	{
+		fprintf( stderr, "Error opening socket to '%s'! (%s)\n", spec,
+				 strerror( errno ) );
+		s = -1;
+	}
+
+	freeaddrinfo( ai );
+
+	return s;
+}
+
+/**
+ * Add event to the datagram being put together
+ */
+void
+add ( int type, int code, int value )
+{
+	struct net_event *e = &packet.ev[ packet.count++ ];
+
+	e->type = htons( type );
+	e->code = htons( code );
+	e->value = htonl( value );
+}
+
+/**
+ * Send the datagram put together so far, stamped with /tv/, and start
+ * another.
+ */
+void
+flush ( int flags, const struct timeval *tv )
+{
+	int count = packet.count;
+
+	packet.magic = htonl( NET_MAGIC );
+	packet.seq = htonl( seq++ );
+	packet.stamp = htobe64( (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec );
+	packet.flags = htons( flags );
+	packet.count = htons( count );
+
+	if ( send( sock, &packet, NET_HEADER_SIZE + count * sizeof( packet.ev[0] ), 0 ) < 0 &&
+		 verbose )
+		perror( "send" );
+
+	if ( verbose )
+		printf( "#%u: %i event(s)%s\n", seq - 1, count,
+				flags & NET_SNAPSHOT ? " (snapshot)" : "" );
+
+	packet.count = 0;
+}
+
+/**
+ * Send everything the device is holding down and every axis position, in
+ * place of any partial report.
+ */
+void
+snapshot ( void )
+{
+	uint8_t evt[ EV_MAX / 8 + 1 ];
+	uint8_t keys[ KEY_MAX / 8 + 1 ];
+	uint8_t axes[ ABS_MAX / 8 + 1 ];
+	struct timeval tv;
+	int i;
+
+	memset( evt, 0, sizeof( evt ) );
+	memset( keys, 0, sizeof( keys ) );
+	memset( axes, 0, sizeof( axes ) );
+
+	ioctl( fd, EVIOCGBIT( 0, sizeof( evt ) ), evt );
+	ioctl( fd, EVIOCGKEY( sizeof( keys ) ), keys );
+
+	if ( testbit( EV_ABS, evt ) )
+		ioctl( fd, EVIOCGBIT( EV_ABS, sizeof( axes ) ), axes );
+
+	packet.count = 0;
+
+	for ( i = 0; i < KEY_MAX && packet.count < NET_MAX_EVENTS; i++ )
+		if ( testbit( i, keys ) )
+			add( EV_KEY, i, 1 );
+
+	for ( i = 0; i < ABS_MAX && packet.count < NET_MAX_EVENTS; i++ )
+	{
+		struct input_absinfo ai;
+
+		if ( testbit( i, axes ) && ioctl( fd, EVIOCGABS( i ), &ai ) == 0 )
+			add( EV_ABS, i, ai.value );
+	}
+
+	gettimeofday( &tv, NULL );
+
+	flush( NET_SNAPSHOT, &tv );
+}
+
+/** main
+ *
+ */
+int
+main ( int argc, char **argv )
+{
+	struct input_event iev[ 64 ];
+	struct pollfd pfd[ 2 ];
+	int dropping = 0;
+
+	fprintf( stderr, "lsmi-forward" " v" VERSION "\n" );
+
+	get_args( argc, argv );
+
+	if ( -1 == ( fd = open( device, O_RDONLY ) ) )
+	{
+		fprintf( stderr, "Error opening event interface! (%s)\n", strerror( errno ) );
+		exit(1);
+	}
+
+	/* the events are for the driver, not for whatever runs here */
+	if ( ioctl( fd, EVIOCGRAB, 1 ) )
+	{
+		perror( "EVIOCGRAB" );
+		exit(1);
+	}
+
+	if ( -1 == ( sock = open_socket( host ) ) )
+		exit( 1 );
+
+	fprintf( stderr, "Forwarding '%s' to '%s'...\n", device, host );
+
+	/* start the driver off knowing where everything is */
+	snapshot();
+
+	pfd[ 0 ].fd = fd;
+	pfd[ 0 ].events = POLLIN;
+	pfd[ 1 ].fd = sock;
+	pfd[ 1 ].events = POLLIN;
+
+	for ( ;; )
+	{
+		int n = poll( pfd, 2, interval );
+
+		if ( n < 0 )
+			continue;
+
+		if ( n == 0 )
+		{
+			/* idle; make sure nothing's stuck at the other end */
+			snapshot();
+			continue;
+		}
+
+		if ( pfd[ 1 ].revents & POLLIN )
+		{
+			struct net_packet req;
+
+			if ( recv( sock, &req, sizeof( req ), 0 ) >= NET_HEADER_SIZE &&
+				 ntohl( req.magic ) == NET_MAGIC &&
+				 ( ntohs( req.flags ) & NET_RESYNC ) )
+			{
+				if ( verbose )
+					printf( "Resync requested.\n" );
+
+				snapshot();
+			}
+		}
+
+		if ( pfd[ 0 ].revents & ( POLLERR | POLLHUP ) )
+		{
+			fprintf( stderr, "Lost '%s'.\n", device );
+			exit( 1 );
+		}
+
+		if ( pfd[ 0 ].revents & POLLIN )
+		{
+			ssize_t r;
+			int i;
+
+			if ( ( r = read( fd, iev, sizeof( iev ) ) ) <= 0 )
+				continue;
+
+			for ( i = 0; i < r / sizeof( iev[0] ); i++ )
+			{
+				struct timeval tv;
+
+				tv.tv_sec = iev[ i ].input_event_sec;
+				tv.tv_usec = iev[ i ].input_event_usec;
+
+				if ( iev[ i ].type == EV_SYN )
+				{
+					switch ( iev[ i ].code )
+					{
+						case SYN_DROPPED:
+							/* the kernel's buffer overran; what's in
+							 * hand is incomplete */
+							dropping = 1;
+							packet.count = 0;
+							break;
+						case SYN_REPORT:
+							if ( dropping )
+							{
+								dropping = 0;
+								snapshot();
+							}
+							else
+							{
+								add( EV_SYN, SYN_REPORT, 0 );
+								flush( 0, &tv );
+							}
+							break;
+					}
+
+					continue;
+				}
+
+				if ( dropping )
+					continue;
+
+				add( iev[ i ].type, iev[ i ].code, iev[ i ].value );
+
+				/* an awfully big report; send what we have */
+				if ( packet.count == NET_MAX_EVENTS )
+					flush( 0, &tv );
+			}
+		}
+	}
+}
@@ -42,6 +42,8 @@
 #include <errno.h>
 #include <alsa/asoundlib.h>
 #include <linux/joystick.h>
+#include <sys/ioctl.h>
+#include <stdint.h>
 
 #include <sys/time.h>
 #include <signal.h>
@@ -49,6 +51,12 @@
 
 #include "seq.h"
 #include "sig.h"
+#include "rt.h"
+#include "stats.h"
+#include "rec.h"
+#include "ctl.h"
+#include "tune.h"
+#include "quant.h"
 
 #define elementsof(x) ( sizeof( (x) ) / sizeof( (x)[0] ) )
 #define min(x,min) ( (x) < (min) ? (min) : (x) )
@@ -74,11 +82,28 @@ int port;
 
 char *sub_name;										/* subscriber */
 
+/* the event device codes behind the joystick's axis and button numbers,
+ * for the flight recorder */
+uint8_t axis_code[ ABS_CNT ];
+uint16_t button_code[ KEY_MAX - BTN_MISC + 1 ];
+
 
 void
 clean_up( void )
 {
   close( jfd );
+
+  stop_output_thread();
+
+  stop_input_thread();
+
+  quant_stop();
+
+  ctl_stop();
+
+  rt_release();
+
+  stats_report();
 }
 
 void
@@ -89,6 +114,48 @@ die( int x )
   exit( 1 );
 }
 
+/**
+ * Find out which event device codes the joystick's axis and button numbers
+ * stand for. Without joydev's maps, assume them in order from ABS_X and
+ * BTN_JOYSTICK.
+ */
+void
+get_codes ( void )
+{
+	int i;
+
+	if ( ioctl( jfd, JSIOCGAXMAP, axis_code ) < 0 )
+		for ( i = 0; i < elementsof( axis_code ); i++ )
+			axis_code[ i ] = ABS_X + i;
+
+	if ( ioctl( jfd, JSIOCGBTNMAP, button_code ) < 0 )
+		for ( i = 0; i < elementsof( button_code ); i++ )
+			button_code[ i ] = BTN_JOYSTICK + i;
+}
+
+/**
+ * Record joystick event /e/ in the flight recorder as the event device
+ * would have reported it, so that the dump replays with evemu.
+ */
+void
+record ( const struct js_event *e )
+{
+	switch ( e->type & ~JS_EVENT_INIT )
+	{
+		case JS_EVENT_BUTTON:
+			rec_input( EV_KEY, button_code[ e->number ], !! e->value );
+			break;
+		case JS_EVENT_AXIS:
+			if ( e->number < elementsof( axis_code ) )
+				rec_input( EV_ABS, axis_code[ e->number ], e->value );
+			break;
+		default:
+			return;
+	}
+
+	rec_input( EV_SYN, SYN_REPORT, 0 );
+}
+
 /** 
  * print help
  */
@@ -101,7 +168,18 @@ usage ( void )
 		" -d | --device specialfile     Event device to use (instead of js0)\n"
 		" -v | --verbose                Be verbose (show note events)\n"
 		" -p | --port client:port       Connect to ALSA Sequencer client on startup\n"					
-		" -n | --no-hold                Send controller data even when no joystick button is held\n" );
+		" -n | --no-hold                Send controller data even when no joystick button is held\n"
+		" -R | --realtime [rr:]rtprio   Use realtime priority 'rtprio' (requires privs)\n"
+		" -a | --affinity cpu           Pin event thread to 'cpu'\n"
+		" -b | --busy-poll              Spin waiting for input (for dedicated CPUs)\n"
+		" -T | --threaded               Write to ALSA from a separate output thread\n"
+		" -O | --output-affinity cpu    Pin output thread to 'cpu' (implies -T)\n"
+		" -S | --stats                  Print latency statistics on exit\n"
+		" -C | --control path           Accept commands on unix socket 'path'\n"
+		" -D | --dump-threshold uS      Dump flight recorder when latency exceeds 'uS'\n"
+		" -t | --tune report|apply      Find the device's IRQ; suggest or set IRQ and CPU affinity\n"
+		" -Q | --quantize n[:s[:w[:m]]] Snap notes to 1/n grid (strength %%, swing %%, max mS)\n"
+		" -B | --tempo bpm|clock[:c:p]  Grid tempo, or follow MIDI clock (from client:port)\n" );
 	fprintf( stderr, 	" -z | --daemon                 Fork and don't print anything to stdout\n"
 	"\n" );
 }
@@ -112,7 +190,7 @@ usage ( void )
 void
 get_args ( int argc, char **argv )
 {
-	const char *short_opts = "hp:c:vd:nz";
+	const char *short_opts = "hp:c:vd:nR:a:bTO:SC:D:t:Q:B:z";
 	const struct option long_opts[] =
 	{
 		{ "help", no_argument, NULL, 'h' },
@@ -121,6 +199,17 @@ get_args ( int argc, char **argv )
 		{ "verbose", no_argument, NULL, 'v' },
 		{ "device", required_argument, NULL, 'd' },
 		{ "no-hold", no_argument, NULL, 'n' },
+		{ "realtime", required_argument, NULL, 'R' },
+		{ "affinity", required_argument, NULL, 'a' },
+		{ "busy-poll", no_argument, NULL, 'b' },
+		{ "threaded", no_argument, NULL, 'T' },
+		{ "output-affinity", required_argument, NULL, 'O' },
+		{ "stats", no_argument, NULL, 'S' },
+		{ "control", required_argument, NULL, 'C' },
+		{ "dump-threshold", required_argument, NULL, 'D' },
+		{ "tune", required_argument, NULL, 't' },
+		{ "quantize", required_argument, NULL, 'Q' },
+		{ "tempo", required_argument, NULL, 'B' },
 		{ "daemon", no_argument, NULL, 'z' },
 		{ NULL, 0, NULL, 0 }
 	};
@@ -161,6 +250,46 @@ get_args ( int argc, char **argv )
 			case 'n':
 				nohold = 1;
 				break;
+			case 'R':
+				if ( rt_parse_priority( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'a':
+				if ( ( rt_cpu = rt_parse_cpu( optarg ) ) < 0 )
+					exit( 1 );
+				break;
+			case 'b':
+				rt_busy = 1;
+				break;
+			case 'T':
+				threaded_output = 1;
+				break;
+			case 'O':
+				threaded_output = 1;
+				if ( ( output_cpu = rt_parse_cpu( optarg ) ) < 0 )
+					exit( 1 );
+				break;
+			case 'S':
+				stats_enabled = 1;
+				break;
+			case 'C':
+				ctl_path = optarg;
+				break;
+			case 'D':
+				rec_threshold = atol( optarg );
+				break;
+			case 't':
+				if ( tune_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'Q':
+				if ( quant_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'B':
+				if ( quant_tempo_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
 			case 'z':
 				daemonize = 1;
 				break;
@@ -179,6 +308,14 @@ main ( int argc, char **argv )
 
 	get_args( argc, argv );
 
+	if ( tune_mode )
+	{
+		tune_device( joydevice );
+
+		if ( tune_mode == TUNE_REPORT )
+			exit( 0 );
+	}
+
 	fprintf( stderr, "Registering MIDI port...\n" );
 
 	seq = open_client( CLIENT_NAME );
@@ -230,8 +367,26 @@ main ( int argc, char **argv )
 		exit(1);
 	}
 
+	get_codes();
+
 	set_traps();
 
+	rt_setup();
+
+	if ( start_output_thread() < 0 )
+		exit( 1 );
+
+	if ( quant_start() < 0 )
+		exit( 1 );
+
+	if ( start_input_thread() < 0 )
+		exit( 1 );
+
+	if ( ctl_start() < 0 )
+		exit( 1 );
+
+	stats_startup();
+
 	fprintf( stderr, "Waiting for events...\n" );
 
 	for ( ;; )
@@ -241,7 +396,9 @@ main ( int argc, char **argv )
 		static int b1;
 		static int b2;
 
-		read (jfd, &e, sizeof(struct js_event));
+		rt_read( jfd, &e, sizeof(struct js_event) );
+
+		record( &e );
 
 		snd_seq_ev_clear( &ev );
 
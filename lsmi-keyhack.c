@@ -117,6 +117,14 @@
 
 #include "seq.h"
 #include "sig.h"
+#include "rt.h"
+#include "stats.h"
+#include "rec.h"
+#include "ctl.h"
+#include "tune.h"
+#include "quant.h"
+#include "net.h"
+#include "state.h"
 
 #define elementsof(x) ( sizeof( (x) ) / sizeof( (x)[0] ) )
 #define min(x,min) ( (x) < (min) ? (min) : (x) )
@@ -129,7 +137,6 @@
 #define UP 0
 
 enum prog_modes { PATCH, BANK, CHANNEL };
-enum prog_modes prog_mode = PATCH;
 
 #define NUM_PROG_MODES 3
 
@@ -141,12 +148,33 @@ char *database = defaultdatabase;
 int verbose = 0;
 int prog_index = 0;
 static char prog_buf[4];
-int channel = 0;
+/* MIDI state */
+struct perf_state defaults = {
+	.channel = 0,
+	.octave = 5,
+	.patch = 0,
+	.bank = 0,
+	.prog_mode = PATCH,
+};
+
+struct perf_state *perf = &defaults;				/* current state */
+char *state_file = NULL;
+int channel_given = 0;							/* -c wins over restored state */
+int resend = 0;
 
-int octave = 5;
 int octave_min = 0;
 int octave_max = 9;
 
+/* what a restored state may hold */
+const struct perf_state state_lo = {
+	.channel = 0, .octave = 0, .patch = 0, .bank = 0,
+	.prog_mode = PATCH, .patch_page = 0, .bank_page = 0,
+};
+const struct perf_state state_hi = {
+	.channel = 15, .octave = 9, .patch = 127, .bank = 127,
+	.prog_mode = CHANNEL, .patch_page = 3, .bank_page = 3,
+};
+
 
 int fd;
 
@@ -154,6 +182,7 @@ snd_seq_t *seq = NULL;
 int port;
 struct timeval timeout;
 
+char *takeover = NULL;					/* predecessor's socket */
 char *sub_name = NULL;					/* subscriber */
 
 char defaultdevice[] = "/dev/input/event0";
@@ -237,7 +266,21 @@ clean_up ( void )
 
 	close( fd );
 
+	stop_output_thread();
+
+	stop_input_thread();
+
+	quant_stop();
+
+	ctl_stop();
+
 	snd_seq_close( seq );
+
+	rt_release();
+
+	stats_report();
+
+	net_report();
 }
 
 /** 
@@ -260,11 +303,25 @@ usage ( void )
 	fprintf( stderr, "Usage: lsmi-keyhack [options]\n"
 			 "Options:\n\n"
 			 " -h | --help                   Show this message\n"
-			 " -d | --device specialfile     Event device to use (instead of event0)\n"
+			 " -d | --device specialfile     Event device to use (instead of event0), or udp:port\n"
 			 " -v | --verbose                Be verbose (show note events)\n"
 			 " -c | --channel n              Initial MIDI channel\n"
 			 " -p | --port client:port       Connect to ALSA Sequencer client on startup\n"
 			 " -k | --keydata file			Name file to read/write key mappings (instead of ~/.keydb)\n"
+			 " -R | --realtime [rr:]rtprio   Use realtime priority 'rtprio' (requires privs)\n"
+			 " -a | --affinity cpu           Pin event thread to 'cpu'\n"
+			 " -b | --busy-poll              Spin waiting for input (for dedicated CPUs)\n"
+			 " -T | --threaded               Write to ALSA from a separate output thread\n"
+			 " -O | --output-affinity cpu    Pin output thread to 'cpu' (implies -T)\n"
+			 " -S | --stats                  Print latency statistics on exit\n"
+			 " -C | --control path           Accept commands on unix socket 'path'\n"
+			 " -D | --dump-threshold uS      Dump flight recorder when latency exceeds 'uS'\n"
+			 " -t | --tune report|apply      Find the device's IRQ; suggest or set IRQ and CPU affinity\n"
+			 " -Q | --quantize n[:s[:w[:m]]] Snap notes to 1/n grid (strength %%, swing %%, max mS)\n"
+			 " -B | --tempo bpm|clock[:c:p]  Grid tempo, or follow MIDI clock (from client:port)\n"
+			 " -X | --takeover path          Take over from the driver at control socket 'path'\n"
+			 " -s | --state file             Keep channel, octave, bank, etc. in 'file' across restarts\n"
+			 " -r | --resend                 Resend restored bank and program on startup\n"
 			 "\n" );
 }
 
@@ -274,7 +331,7 @@ usage ( void )
 void
 get_args ( int argc, char **argv )
 {
-	const char *short_opts = "hp:c:d:k:v";
+	const char *short_opts = "hp:c:d:k:vR:a:bTO:SC:D:t:Q:B:X:s:r";
 	const struct option long_opts[] = {
 		{"help", no_argument, NULL, 'h'},
 		{"port", required_argument, NULL, 'p'},
@@ -282,6 +339,20 @@ get_args ( int argc, char **argv )
 		{"device", required_argument, NULL, 'd'},
 		{"keydata", required_argument, NULL, 'k'},
 		{"verbose", no_argument, NULL, 'v'},
+		{"realtime", required_argument, NULL, 'R'},
+		{"affinity", required_argument, NULL, 'a'},
+		{"busy-poll", no_argument, NULL, 'b'},
+		{"threaded", no_argument, NULL, 'T'},
+		{"output-affinity", required_argument, NULL, 'O'},
+		{"stats", no_argument, NULL, 'S'},
+		{"control", required_argument, NULL, 'C'},
+		{"dump-threshold", required_argument, NULL, 'D'},
+		{"tune", required_argument, NULL, 't'},
+		{"quantize", required_argument, NULL, 'Q'},
+		{"tempo", required_argument, NULL, 'B'},
+		{"takeover", required_argument, NULL, 'X'},
+		{"state", required_argument, NULL, 's'},
+		{"resend", no_argument, NULL, 'r'},
 		{NULL, 0, NULL, 0}
 	};
 
@@ -300,12 +371,13 @@ get_args ( int argc, char **argv )
 				sub_name = optarg;
 				break;
 			case 'c':
-				channel = atoi( optarg );
+				channel_given = 1;
+				perf->channel = atoi( optarg );
 
-				fprintf( stderr, "Using initial channel %i", channel );
+				fprintf( stderr, "Using initial channel %i", perf->channel );
 
-				if ( channel >= 1 && channel <= 16 )
-					channel = channel - 1;
+				if ( perf->channel >= 1 && perf->channel <= 16 )
+					perf->channel = perf->channel - 1;
 				else
 				{
 					fprintf( stderr,
@@ -321,6 +393,55 @@ get_args ( int argc, char **argv )
 			case 'v':
 				verbose = 1;
 				break;
+			case 'R':
+				if ( rt_parse_priority( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'a':
+				if ( ( rt_cpu = rt_parse_cpu( optarg ) ) < 0 )
+					exit( 1 );
+				break;
+			case 'b':
+				rt_busy = 1;
+				break;
+			case 'T':
+				threaded_output = 1;
+				break;
+			case 'O':
+				threaded_output = 1;
+				if ( ( output_cpu = rt_parse_cpu( optarg ) ) < 0 )
+					exit( 1 );
+				break;
+			case 'S':
+				stats_enabled = 1;
+				break;
+			case 'C':
+				ctl_path = optarg;
+				break;
+			case 'D':
+				rec_threshold = atol( optarg );
+				break;
+			case 't':
+				if ( tune_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'Q':
+				if ( quant_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'B':
+				if ( quant_tempo_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'X':
+				takeover = optarg;
+				break;
+			case 's':
+				state_file = optarg;
+				break;
+			case 'r':
+				resend = 1;
+				break;
 		}
 
 	}
@@ -337,7 +458,9 @@ get_keypress ( int *state )
 
 	for ( ;; )
 	{
-		read( fd, &iev, sizeof( iev ) );
+		rt_read( fd, &iev, sizeof( iev ) );
+
+		rec_input( iev.type, iev.code, iev.value );
 
 		if ( iev.type != EV_KEY || iev.value == 2 )
 			continue;
@@ -422,13 +545,17 @@ update_leds ( void )
 	struct input_event iev;
 	int i;
 
+	/* a forwarded keyboard's LEDs are at the other end */
+	if ( net_owns( fd ) )
+		return;
+
 	for ( i = 0; i < 3; i++ )
 	{
 		iev.type = EV_LED;
 
 		iev.code = i;
 
-		if ( i == prog_mode )
+		if ( i == perf->prog_mode )
 			iev.value = 1;
 		else
 			iev.value = 0;
@@ -521,10 +648,10 @@ learn_mode ( void )
 			map[i].number -= key_offset;
 	}
 
-	if ( map[keyi].number + ( 12 * octave ) != 60 )
+	if ( map[keyi].number + ( 12 * perf->octave ) != 60 )
 	{
 		fprintf( stderr, "Error in key logic! ( middle C == %i )\n",
-				 map[keyi].number + ( 12 * octave ) );
+				 map[keyi].number + ( 12 * perf->octave ) );
 	}
 
 	printf
@@ -584,6 +711,50 @@ learn_mode ( void )
 }
 
 
+/**
+ * Work out where the key database lives, if -k didn't say
+ */
+void
+find_database ( void )
+{
+	if ( database == defaultdatabase )
+	{
+		char *home = getenv( "HOME" );
+
+		database = malloc( strlen( home ) + strlen( defaultdatabase ) + 2 );
+
+		sprintf( database, "%s/%s", home, defaultdatabase );
+	}
+}
+
+/**
+ * Load the key database, or learn one, and work out the size of the
+ * keyboard.
+ */
+void
+load_config ( int *keys, int *mc_offset )
+{
+	fprintf( stderr, "Opening database...\n" );
+
+	if ( -1 == open_database( database ) )
+	{
+		/* our predecessor is parked until we're ready; don't keep it */
+		if ( takeover )
+		{
+			fprintf( stderr, "Key database '%s' went away!\n", database );
+			exit( 1 );
+		}
+
+		fprintf( stderr, "******Key database missing or invalid******\n"
+				 "Entering learning mode...\n"
+				 "Make sure your \"keyboard\" device is connected!\n" );
+
+		learn_mode();
+	}
+
+	analyze_map( keys, mc_offset );
+}
+
 /** main 
  *
  */
@@ -592,83 +763,96 @@ main ( int argc, char **argv )
 {
 	int keys = 0;
 	int mc_offset = 0;
+	int restored;
 
 	snd_seq_event_t ev;
 
-	int patch = 0;
-	int bank = 0;
 
 	fprintf( stderr, "lsmi-keyhack" " v" VERSION "\n" );
 
 	get_args( argc, argv );
 
-	fprintf( stderr, "Registering MIDI port...\n" );
-
-	seq = open_client( CLIENT_NAME );
-
-	if ( NULL == seq )
-	{
-		fprintf( stderr, "Error opening alsa sequencer!\n" );
-		exit( 1 );
-	}
+	find_database();
 
-	if ( ( port = open_output_port( seq ) ) < 0 )
+	/* learning needs the keyboard to ourselves, and can't be done while
+	 * the driver we'd take over from waits */
+	if ( takeover && access( database, R_OK ) < 0 )
 	{
-		fprintf( stderr, "Error opening MIDI output port!\n" );
+		fprintf( stderr, "Can't take over without a key database ('%s')! "
+				 "Stop the running driver and learn one first.\n", database );
 		exit( 1 );
 	}
 
-	if ( sub_name )
+	if ( tune_mode )
 	{
-		snd_seq_addr_t addr;
+		tune_device( device );
 
-		if ( snd_seq_parse_address( seq, &addr, sub_name ) < 0 )
-			fprintf( stderr, "Couldn't parse address '%s'", sub_name );
-		else if ( snd_seq_connect_to( seq, port, addr.client, addr.port ) <
-				  0 )
-		{
-			fprintf( stderr, "Error creating subscription for port %i:%i",
-					 addr.client, addr.port );
-			exit( 1 );
-		}
+		if ( tune_mode == TUNE_REPORT )
+			exit( 0 );
 	}
 
-	fprintf( stderr, "Initializing keyboard...\n" );
+	perf = state_open( state_file, perf, &state_lo, &state_hi, &restored );
 
-	if ( -1 == ( fd = open( device, O_RDWR ) ) )
+	if ( restored )
+		fprintf( stderr, "Restored state from '%s'.\n", state_file );
+
+	/* the command line has the last word */
+	if ( restored && channel_given && perf->channel != defaults.channel )
 	{
-		fprintf( stderr, "Error opening event interface! (%s)\n",
-				 strerror( errno ) );
-		exit( 1 );
+		fprintf( stderr, "Channel %i from the command line overrides %i from '%s'.\n",
+				 defaults.channel + 1, perf->channel + 1, state_file );
+
+		perf->channel = defaults.channel;
 	}
 
-	init_keyboard();
+	fprintf( stderr, "Registering MIDI port...\n" );
 
-	set_traps();
+	/* the keyboard can be set up while ALSA loads */
+	start_client_setup( CLIENT_NAME, sub_name );
 
-	update_leds();
+	if ( takeover )
+	{
+		if ( finish_client_setup() < 0 )
+			exit( 1 );
 
-	fprintf( stderr, "Opening database...\n" );
+		/* the keyboard is already grabbed, and we play on where it left off */
+		if ( ctl_takeover( takeover, &fd, 1, perf, sizeof( *perf ) ) < 0 )
+			exit( 1 );
 
-	if ( database == defaultdatabase )
+		if ( net_source( device ) )
+			net_attach( fd );
+	}
+	else
 	{
-		char *home = getenv( "HOME" );
+		fprintf( stderr, "Initializing keyboard...\n" );
 
-		database = malloc( strlen( home ) + strlen( defaultdatabase ) + 2 );
+		if ( net_source( device ) )
+		{
+			/* checked and grabbed by the forwarder */
+			if ( -1 == ( fd = net_open( device ) ) )
+				exit( 1 );
+		}
+		else
+		{
+			if ( -1 == ( fd = open( device, O_RDWR ) ) )
+			{
+				fprintf( stderr, "Error opening event interface! (%s)\n",
+						 strerror( errno ) );
+				exit( 1 );
+			}
 
-		sprintf( database, "%s/%s", home, defaultdatabase );
+			init_keyboard();
+		}
 	}
 
-	if ( -1 == open_database( database ) )
-	{
-		fprintf( stderr, "******Key database missing or invalid******\n"
-				 "Entering learning mode...\n"
-				 "Make sure your \"keyboard\" device is connected!\n" );
+	set_traps();
 
-		learn_mode();
-	}
+	update_leds();
 
-	analyze_map( &keys, &mc_offset );
+	load_config( &keys, &mc_offset );
+
+	if ( finish_client_setup() < 0 )
+		exit( 1 );
 
 	octave_min = ( mc_offset / 12 ) + 1;
 	octave_max = 9 - ( ( keys - mc_offset ) / 12 );
@@ -677,6 +861,31 @@ main ( int argc, char **argv )
 			 "%i keys, middle C is %ith from the left, lowest MIDI octave == %i, highest, %i\n",
 			 keys, mc_offset + 1, octave_min, octave_max );
 
+	/* restored (or handed over) for a different keyboard, perhaps */
+	perf->octave = max( min( perf->octave, octave_min ), octave_max );
+
+	rt_setup();
+
+	if ( start_output_thread() < 0 )
+		exit( 1 );
+
+	if ( quant_start() < 0 )
+		exit( 1 );
+
+	if ( start_input_thread() < 0 )
+		exit( 1 );
+
+	if ( ctl_start() < 0 )
+		exit( 1 );
+
+	if ( restored && resend && ! takeover )
+		state_resend( perf );
+
+	ctl_offer( &fd, 1, perf, sizeof( *perf ) );
+	ctl_confirm();
+
+	stats_startup();
+
 	fprintf( stderr, "Waiting for events...\n" );
 
 	for ( ;; )
@@ -697,7 +906,7 @@ main ( int argc, char **argv )
 			switch ( map[keyi].control )
 			{
 					/* All notes off */
-					snd_seq_ev_set_controller( &ev, channel, 123, 0 );
+					snd_seq_ev_set_controller( &ev, perf->channel, 123, 0 );
 					send_event( &ev );
 					snd_seq_ev_clear( &ev );
 
@@ -713,55 +922,55 @@ main ( int argc, char **argv )
 
 				case CKEY_MODE:
 
-					prog_mode =
-						prog_mode + 1 >
-						NUM_PROG_MODES - 1 ? 0 : prog_mode + 1;
+					perf->prog_mode =
+						perf->prog_mode + 1 >
+						NUM_PROG_MODES - 1 ? 0 : perf->prog_mode + 1;
 					fprintf( stderr, "Input mode change to %s\n",
-							 mode_names[prog_mode] );
+							 mode_names[perf->prog_mode] );
 
 					update_leds();
 
 					break;
 
 				case CKEY_OCTAVE_DOWN:
-					octave = min( octave - 1, octave_min );
+					perf->octave = min( perf->octave - 1, octave_min );
 					break;
 				case CKEY_OCTAVE_UP:
-					octave = max( octave + 1, octave_max );
+					perf->octave = max( perf->octave + 1, octave_max );
 					break;
 				case CKEY_CHANNEL_DOWN:
-					channel = min( channel - 1, 0 );
+					perf->channel = min( perf->channel - 1, 0 );
 					break;
 				case CKEY_CHANNEL_UP:
-					channel = max( channel + 1, 15 );
+					perf->channel = max( perf->channel + 1, 15 );
 					break;
 				case CKEY_PATCH_DOWN:
-					if ( patch == 0 && bank > 0 )
+					if ( perf->patch == 0 && perf->bank > 0 )
 					{
-						bank = min( bank - 1, 0 );
-						patch = 127;
+						perf->bank = min( perf->bank - 1, 0 );
+						perf->patch = 127;
 
-						snd_seq_ev_set_controller( &e, channel, 0, bank );
+						snd_seq_ev_set_controller( &e, perf->channel, 0, perf->bank );
 						send_event( &e );
 					}
 					else
-						patch = min( patch - 1, 0 );
+						perf->patch = min( perf->patch - 1, 0 );
 
-					snd_seq_ev_set_pgmchange( &ev, channel, patch );
+					snd_seq_ev_set_pgmchange( &ev, perf->channel, perf->patch );
 					break;
 				case CKEY_PATCH_UP:
-					if ( patch == 127 && bank < 127 )
+					if ( perf->patch == 127 && perf->bank < 127 )
 					{
-						bank = max( bank + 1, 127 );
-						patch = 0;
+						perf->bank = max( perf->bank + 1, 127 );
+						perf->patch = 0;
 
-						snd_seq_ev_set_controller( &e, channel, 0, bank );
+						snd_seq_ev_set_controller( &e, perf->channel, 0, perf->bank );
 						send_event( &e );
 					}
 					else
-						patch = max( patch + 1, 127 );
+						perf->patch = max( perf->patch + 1, 127 );
 
-					snd_seq_ev_set_pgmchange( &ev, channel, patch );
+					snd_seq_ev_set_pgmchange( &ev, perf->channel, perf->patch );
 					break;
 
 				case CKEY_NUMERIC:
@@ -779,22 +988,22 @@ main ( int argc, char **argv )
 					timeout = tv;
 
 					if ( prog_index == 0 )
-						printf( "INPUT %s #: ", mode_names[prog_mode] );
+						printf( "INPUT %s #: ", mode_names[perf->prog_mode] );
 				}
 
 					prog_buf[prog_index++] = 48 + map[keyi].number;
 					printf( "%i", map[keyi].number );
 					fflush( stdout );
 
-					if ( prog_index == 2 && prog_mode == CHANNEL )
+					if ( prog_index == 2 && perf->prog_mode == CHANNEL )
 					{
 
 						/* FIXME: all notes off->channel */
 
 						prog_buf[++prog_index] = '\0';
-						channel = atoi( prog_buf );
+						perf->channel = atoi( prog_buf );
 
-						channel = max( channel, 15 );
+						perf->channel = max( perf->channel, 15 );
 
 						prog_index = 0;
 
@@ -804,24 +1013,24 @@ main ( int argc, char **argv )
 					{
 						prog_buf[++prog_index] = '\0';
 
-						switch ( prog_mode )
+						switch ( perf->prog_mode )
 						{
 							case PATCH:
-								patch = atoi( prog_buf );
+								perf->patch = atoi( prog_buf );
 
-								patch = max( patch, 127 );
+								perf->patch = max( perf->patch, 127 );
 
-								snd_seq_ev_set_pgmchange( &ev, channel,
-														  patch );
+								snd_seq_ev_set_pgmchange( &ev, perf->channel,
+														  perf->patch );
 
 								break;
 							case BANK:
-								bank = atoi( prog_buf );
+								perf->bank = atoi( prog_buf );
 
-								bank = max( bank, 127 );
+								perf->bank = max( perf->bank, 127 );
 
-								snd_seq_ev_set_controller( &ev, channel, 0,
-														   bank );
+								snd_seq_ev_set_controller( &ev, perf->channel, 0,
+														   perf->bank );
 								break;
 							default:
 								fprintf( stderr, "Internal error!\n" );
@@ -845,7 +1054,7 @@ main ( int argc, char **argv )
 			{
 				case SND_SEQ_EVENT_CONTROLLER:
 
-					snd_seq_ev_set_controller( &ev, channel,
+					snd_seq_ev_set_controller( &ev, perf->channel,
 											   map[keyi].number,
 											   newstate == DOWN ? 127 : 0 );
 
@@ -854,13 +1063,13 @@ main ( int argc, char **argv )
 				case SND_SEQ_EVENT_NOTE:
 
 					if ( newstate == DOWN )
-						snd_seq_ev_set_noteon( &ev, channel,
+						snd_seq_ev_set_noteon( &ev, perf->channel,
 											   map[keyi].number +
-											   ( 12 * octave ), 64 );
+											   ( 12 * perf->octave ), 64 );
 					else
-						snd_seq_ev_set_noteoff( &ev, channel,
+						snd_seq_ev_set_noteoff( &ev, perf->channel,
 												map[keyi].number +
-												( 12 * octave ), 64 );
+												( 12 * perf->octave ), 64 );
 					break;
 
 				default:
@@ -149,12 +149,17 @@
 #include <linux/input.h>
 #include <linux/uinput.h>
 
-#include <sched.h>
-
 #include <stdint.h>
 
 #include "seq.h"
 #include "sig.h"
+#include "rt.h"
+#include "stats.h"
+#include "rec.h"
+#include "ctl.h"
+#include "tune.h"
+#include "quant.h"
+#include "state.h"
 
 #define elementsof(x) ( sizeof( (x) ) / sizeof( (x)[0] ) )
 #define min(x,min) ( (x) < (min) ? (min) : (x) )
@@ -189,16 +194,36 @@ int no_velocity = 0;
 int daemonize = 0;
 
 /* MIDI state */
-int channel = 0;
-int patch_page = 0;
-int bank_page = 0;
-int patch = 0;
-int bank = 0;
-int octave = 5; 
+enum prog_modes { MUSIC, PATCH, BANK, CHANNEL };
+
+struct perf_state defaults = {
+	.channel = 0,
+	.octave = 5,
+	.patch = 0,
+	.bank = 0,
+	.prog_mode = MUSIC,
+	.patch_page = 0,
+	.bank_page = 0,
+};
+
+struct perf_state *perf = &defaults;				/* current state */
+char *state_file = NULL;
+int channel_given = 0;							/* -c wins over restored state */
+int resend = 0;
 
 const int octave_min = 3;
 const int octave_max = 7;
 
+/* what a restored state may hold */
+const struct perf_state state_lo = {
+	.channel = 0, .octave = 3, .patch = 0, .bank = 0,
+	.prog_mode = MUSIC, .patch_page = 0, .bank_page = 0,
+};
+const struct perf_state state_hi = {
+	.channel = 15, .octave = 7, .patch = 127, .bank = 127,
+	.prog_mode = CHANNEL, .patch_page = 3, .bank_page = 3,
+};
+
 char defaultdevice[] = "/dev/input/event0";
 char *device = defaultdevice;
 
@@ -208,6 +233,7 @@ int uifd;											/* uinput fd */
 snd_seq_t *seq = NULL;								/* alsa_seq handle */
 int port;											/* our output port */
 
+char *takeover = NULL;								/* predecessor's socket */
 char *sub_name = NULL;								/* subscriber */
 
 static int keymap[KEY_MIN_INTERESTING + 1];
@@ -293,7 +319,19 @@ clean_up ( void )
 	close( uifd );
  	close( fd );
 
+	stop_output_thread();
+
+	stop_input_thread();
+
+	quant_stop();
+
+	ctl_stop();
+
 	snd_seq_close( seq );
+
+	rt_release();
+
+	stats_report();
 }
 
 /** 
@@ -321,7 +359,20 @@ usage ( void )
 		" -h | --help                   Show this message\n"
 		" -d | --device specialfile     Event device to use (instead of event0)\n"
 		" -v | --verbose                Be verbose (show note events)\n"
-		" -R | --realtime rtprio        Use realtime priority 'rtprio' (requires privs)\n"
+		" -R | --realtime [rr:]rtprio   Use realtime priority 'rtprio' (requires privs)\n"
+		" -a | --affinity cpu           Pin event thread to 'cpu'\n"
+		" -b | --busy-poll              Spin waiting for input (for dedicated CPUs)\n"
+		" -T | --threaded               Write to ALSA from a separate output thread\n"
+		" -O | --output-affinity cpu    Pin output thread to 'cpu' (implies -T)\n"
+		" -S | --stats                  Print latency statistics on exit\n"
+		" -C | --control path           Accept commands on unix socket 'path'\n"
+		" -D | --dump-threshold uS      Dump flight recorder when latency exceeds 'uS'\n"
+		" -t | --tune report|apply      Find the device's IRQ; suggest or set IRQ and CPU affinity\n"
+		" -Q | --quantize n[:s[:w[:m]]] Snap notes to 1/n grid (strength %%, swing %%, max mS)\n"
+		" -B | --tempo bpm|clock[:c:p]  Grid tempo, or follow MIDI clock (from client:port)\n"
+		" -X | --takeover path          Take over from the driver at control socket 'path'\n"
+		" -s | --state file             Keep channel, octave, bank, etc. in 'file' across restarts\n"
+		" -r | --resend                 Resend restored bank and program on startup\n"
 		" -n | --no-velocity            Ignore velocity information from keyboard\n"
 		" -c | --channel n              Initial MIDI channel\n"
 		" -p | --port client:port       Connect to ALSA Sequencer client on startup\n" );
@@ -337,7 +388,7 @@ usage ( void )
 void
 get_args ( int argc, char **argv )
 {
-	const char *short_opts = "hp:c:vnd:R:z";
+	const char *short_opts = "hp:c:vnd:R:a:bTO:SC:D:t:Q:B:X:s:rz";
 	const struct option long_opts[] =
 	{
 		{ "help", no_argument, NULL, 'h' },
@@ -347,6 +398,19 @@ get_args ( int argc, char **argv )
 		{ "no-veloticy", no_argument, NULL, 'n' },
 		{ "device", required_argument, NULL, 'd' },
 		{ "realtime", required_argument, NULL, 'R' },
+		{ "affinity", required_argument, NULL, 'a' },
+		{ "busy-poll", no_argument, NULL, 'b' },
+		{ "threaded", no_argument, NULL, 'T' },
+		{ "output-affinity", required_argument, NULL, 'O' },
+		{ "stats", no_argument, NULL, 'S' },
+		{ "control", required_argument, NULL, 'C' },
+		{ "dump-threshold", required_argument, NULL, 'D' },
+		{ "tune", required_argument, NULL, 't' },
+		{ "quantize", required_argument, NULL, 'Q' },
+		{ "tempo", required_argument, NULL, 'B' },
+		{ "takeover", required_argument, NULL, 'X' },
+		{ "state", required_argument, NULL, 's' },
+		{ "resend", no_argument, NULL, 'r' },
 		{ "daemon", no_argument, NULL, 'z' },
 		{ NULL, 0, NULL, 0 }
 	};
@@ -366,12 +430,13 @@ get_args ( int argc, char **argv )
 				sub_name = optarg;
 				break;
 			case 'c':
-				channel = atoi( optarg );
+				channel_given = 1;
+				perf->channel = atoi( optarg );
 
-				fprintf( stderr, "Using initial channel %i", channel );
+				fprintf( stderr, "Using initial channel %i", perf->channel );
 
-				if ( channel >= 1 && channel <= 16 )
-					channel = channel - 1;
+				if ( perf->channel >= 1 && perf->channel <= 16 )
+					perf->channel = perf->channel - 1;
 				else
 				{
 					fprintf( stderr, "Channel number must be bewteen 1 and 16!\n" );
@@ -389,21 +454,53 @@ get_args ( int argc, char **argv )
 				no_velocity = 1;
 				break;
 			case 'R':
-				{
-					struct sched_param sp;
-
-					sp.sched_priority = atoi( optarg );
-
-					if ( sched_setscheduler( 0, SCHED_FIFO, &sp ) < 0 )
-					{
-						perror( "sched_setscheduler()" );
-						fprintf( stderr, "Failed to get realtime priority!\n" );
-						exit( 1 );
-					}
-
-					fprintf( stderr, "Using realtime priority %i.\n", 
-						sp.sched_priority );
-				}
+				if ( rt_parse_priority( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'a':
+				if ( ( rt_cpu = rt_parse_cpu( optarg ) ) < 0 )
+					exit( 1 );
+				break;
+			case 'b':
+				rt_busy = 1;
+				break;
+			case 'T':
+				threaded_output = 1;
+				break;
+			case 'O':
+				threaded_output = 1;
+				if ( ( output_cpu = rt_parse_cpu( optarg ) ) < 0 )
+					exit( 1 );
+				break;
+			case 'S':
+				stats_enabled = 1;
+				break;
+			case 'C':
+				ctl_path = optarg;
+				break;
+			case 'D':
+				rec_threshold = atol( optarg );
+				break;
+			case 't':
+				if ( tune_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'Q':
+				if ( quant_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'B':
+				if ( quant_tempo_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'X':
+				takeover = optarg;
+				break;
+			case 's':
+				state_file = optarg;
+				break;
+			case 'r':
+				resend = 1;
 				break;
 			case 'z':
 				daemonize = 1;
@@ -413,9 +510,6 @@ get_args ( int argc, char **argv )
 }
 
 
-enum prog_modes { MUSIC, PATCH, BANK, CHANNEL };
-enum prog_modes prog_mode = MUSIC;
-
 /** 
  * Process function key press, returns 0 if /key/ isn't a function key
  */
@@ -425,71 +519,71 @@ func_key ( int key )
 	switch ( key )
 	{
 		case KEY_F1:
-			patch_page = 0;
-			prog_mode = PATCH;
+			perf->patch_page = 0;
+			perf->prog_mode = PATCH;
 			break;	
 		case KEY_F2:
-			patch_page = 1;
-			prog_mode = PATCH;
+			perf->patch_page = 1;
+			perf->prog_mode = PATCH;
 			break;	
 		case KEY_F3:
-			patch_page = 2;
-			prog_mode = PATCH;
+			perf->patch_page = 2;
+			perf->prog_mode = PATCH;
 			break;	
 		case KEY_F4:
-		 	patch_page = 3;
-			prog_mode = PATCH;
+		 	perf->patch_page = 3;
+			perf->prog_mode = PATCH;
 			break;	
 
 		case KEY_F5:
-			bank_page = 0;
-			prog_mode = BANK;
+			perf->bank_page = 0;
+			perf->prog_mode = BANK;
 			break;	
 		case KEY_F6:
-			bank_page = 1;
-			prog_mode = BANK;
+			perf->bank_page = 1;
+			perf->prog_mode = BANK;
 			break;	
 		case KEY_F7:
-			bank_page = 2;
-			prog_mode = BANK;
+			perf->bank_page = 2;
+			perf->prog_mode = BANK;
 			break;	
 		case KEY_F8:
-		 	bank_page = 3;
-			prog_mode = BANK;
+		 	perf->bank_page = 3;
+			perf->prog_mode = BANK;
 			break;	
 
 		case KEY_KP4:
 			
-			if ( prog_mode == CHANNEL )
+			if ( perf->prog_mode == CHANNEL )
 			{
-				channel = min( channel - 1, 0 );
-				printf( "Channel Change: %i\n", channel );
+				perf->channel = min( perf->channel - 1, 0 );
+				printf( "Channel Change: %i\n", perf->channel );
 			}
 			else
 			{
-				octave = min( octave - 1, octave_min );
-				printf("Octave Change: %i\n", octave );
+				perf->octave = min( perf->octave - 1, octave_min );
+				printf("Octave Change: %i\n", perf->octave );
 			}
 
 
 			break;
 		case KEY_KP6:
 
-			if ( prog_mode == CHANNEL )
+			if ( perf->prog_mode == CHANNEL )
 			{
-				channel = max( channel + 1, 15 );
-				printf("Channel Change: %i\n", channel );
+				perf->channel = max( perf->channel + 1, 15 );
+				printf("Channel Change: %i\n", perf->channel );
 			}
 			else
 			{
-				octave = max( octave + 1, octave_max );
-				printf( "Octave Change: %i\n", octave );
+				perf->octave = max( perf->octave + 1, octave_max );
+				printf( "Octave Change: %i\n", perf->octave );
 			}
 
 			break;
 
 		case KEY_ENTER:
-			prog_mode = CHANNEL;
+			perf->prog_mode = CHANNEL;
 			break;
 
 		default:
@@ -637,11 +731,34 @@ main ( int argc, char **argv )
 	int key, value, scancode = -1;
 
 	time_t quaver_sec = 0;
+	int restored;
 
 	fprintf( stderr, "\nlsmi-monterey" " v" VERSION "\n" );
 
 	get_args( argc, argv );
 
+	if ( tune_mode )
+	{
+		tune_device( device );
+
+		if ( tune_mode == TUNE_REPORT )
+			exit( 0 );
+	}
+
+	perf = state_open( state_file, perf, &state_lo, &state_hi, &restored );
+
+	if ( restored )
+		fprintf( stderr, "Restored state from '%s'.\n", state_file );
+
+	/* the command line has the last word */
+	if ( restored && channel_given && perf->channel != defaults.channel )
+	{
+		fprintf( stderr, "Channel %i from the command line overrides %i from '%s'.\n",
+				 defaults.channel + 1, perf->channel + 1, state_file );
+
+		perf->channel = defaults.channel;
+	}
+
 	init_maps();
 
 	fprintf( stderr, "Registering MIDI port...\n" );
@@ -672,15 +789,29 @@ main ( int argc, char **argv )
 		}
 	}
 
-	fprintf( stderr, "Initializing keyboard...\n" );
+	if ( takeover )
+	{
+		int fds[ 2 ];
 
-	if ( -1 == ( fd = open( device, O_RDWR ) ) )
-	{ 
-		fprintf( stderr, "Error opening event interface! (%s)\n", strerror( errno ) );
-		exit(1);
+		/* keep the grab and the uinput keyboard X already knows about */
+		if ( ctl_takeover( takeover, fds, 2, perf, sizeof( *perf ) ) < 0 )
+			exit( 1 );
+
+		fd = fds[ 0 ];
+		uifd = fds[ 1 ];
 	}
+	else
+	{
+		fprintf( stderr, "Initializing keyboard...\n" );
 
-	init_keyboard();
+		if ( -1 == ( fd = open( device, O_RDWR ) ) )
+		{ 
+			fprintf( stderr, "Error opening event interface! (%s)\n", strerror( errno ) );
+			exit(1);
+		}
+
+		init_keyboard();
+	}
 
 	if ( daemonize )
 	{
@@ -696,6 +827,36 @@ main ( int argc, char **argv )
 
 	set_traps();
 
+	rt_setup();
+
+	if ( start_output_thread() < 0 )
+		exit( 1 );
+
+	if ( quant_start() < 0 )
+		exit( 1 );
+
+	if ( start_input_thread() < 0 )
+		exit( 1 );
+
+	if ( ctl_start() < 0 )
+		exit( 1 );
+
+	if ( restored && resend && ! takeover )
+		state_resend( perf );
+
+	{
+		int fds[ 2 ];
+
+		fds[ 0 ] = fd;
+		fds[ 1 ] = uifd;
+
+		ctl_offer( fds, 2, perf, sizeof( *perf ) );
+	}
+
+	ctl_confirm();
+
+	stats_startup();
+
 	fprintf( stderr, "Waiting for events...\n" );
 
 	for ( ;; )
@@ -711,7 +872,7 @@ main ( int argc, char **argv )
 		tv.tv_sec = 0;
 		tv.tv_usec = KEY_TIMEOUT;
 
-		retval = select( max( fd, uifd ) + 1, &rfds, NULL, NULL,
+		retval = rt_select( max( fd, uifd ) + 1, &rfds,
 			 expecting != KEY ? &tv : NULL  );
 			 
 		if ( retval == -1 )
@@ -732,7 +893,9 @@ main ( int argc, char **argv )
 			/* Handle keyboard input */
 			if ( FD_ISSET( fd, &rfds ) )
 			{
-				read( fd, &iev, sizeof( iev ) );
+				rt_read( fd, &iev, sizeof( iev ) );
+
+				rec_input( iev.type, iev.code, iev.value );
 
 				switch ( iev.type )
 				{
@@ -787,7 +950,7 @@ main ( int argc, char **argv )
 						if ( iev.code == KEY_F9 )
 						{
 							quaver_sec = iev.time.tv_sec;
-							prog_mode = MUSIC;
+							perf->prog_mode = MUSIC;
 						}
 						else
 						if ( ( iev.time.tv_sec - quaver_sec )
@@ -821,30 +984,30 @@ main ( int argc, char **argv )
 							snd_seq_ev_clear( &ev );
 		
 
-							switch ( prog_mode )
+							switch ( perf->prog_mode )
 							{
 
 								case PATCH:
-									patch = max( keymap[ prev_iev.code ], 31 ) +
-										( 32 * patch_page );
+									perf->patch = max( keymap[ prev_iev.code ], 31 ) +
+										( 32 * perf->patch_page );
 
 
-									snd_seq_ev_set_pgmchange( &ev, channel, patch );
-									prog_mode = MUSIC;
+									snd_seq_ev_set_pgmchange( &ev, perf->channel, perf->patch );
+									perf->prog_mode = MUSIC;
 									break;
 								case BANK:
-									bank = max( keymap[ prev_iev.code ], 31 ) +
-										( 32 * bank_page );
+									perf->bank = max( keymap[ prev_iev.code ], 31 ) +
+										( 32 * perf->bank_page );
 
-									snd_seq_ev_set_controller( &ev, channel, 0, bank );
-									prog_mode = MUSIC;
+									snd_seq_ev_set_controller( &ev, perf->channel, 0, perf->bank );
+									perf->prog_mode = MUSIC;
 									break;
 
 								default:
 								{
 
 									/* This MUST be a piano key! */
-									int note = ( keymap[ prev_iev.code ] - 19 ) + ( 12 * octave );
+									int note = ( keymap[ prev_iev.code ] - 19 ) + ( 12 * perf->octave );
 									int velocity = nummap[ iev.code ];
 
 
@@ -864,7 +1027,7 @@ main ( int argc, char **argv )
 										velocity = 64;
 
 									/* finally, generate a noteon */
-									snd_seq_ev_set_noteon( &ev, channel, note, velocity );
+									snd_seq_ev_set_noteon( &ev, perf->channel, note, velocity );
 									break;
 								}
 
@@ -61,6 +61,14 @@
 
 #include "seq.h"
 #include "sig.h"
+#include "rt.h"
+#include "stats.h"
+#include "rec.h"
+#include "ctl.h"
+#include "tune.h"
+#include "quant.h"
+#include "cache.h"
+#include "net.h"
 
 #define min(x,min) ( (x) < (min) ? (min) : (x) )
 #define max(x,max) ( (x) > (max) ? (max) : (x) )
@@ -74,12 +82,15 @@
 #define UP 0
 
 char *sub_name = NULL;
+char *takeover = NULL;								/* predecessor's socket */
 int verbose = 0;
 int port = 0;
 snd_seq_t *seq = NULL;
 
 int daemonize = 0;
 
+char *map_arg[ 3 ];								/* as given, until applied */
+
 char defaultdevice[] = "/dev/input/event2";
 char *device = defaultdevice;
 
@@ -134,6 +145,33 @@ parse_map ( int i, const char *s )
 		SND_SEQ_EVENT_CONTROLLER : SND_SEQ_EVENT_NOTEON;
 }
 
+/**
+ * Apply the mappings given on the command line (compiling them for
+ * /fd/'s device, or for any if -1), or their compiled form from the cache.
+ */
+void
+load_config ( int fd )
+{
+	uint64_t key = cache_key( map_arg, 3, fd );
+	const void *compiled;
+	int i;
+
+	/* and what they apply to, in case that changed with a new build */
+	key = cache_hash( key, map, sizeof( map ) );
+
+	if ( ( compiled = cache_load( key, sizeof( map ) ) ) )
+	{
+		memcpy( map, compiled, sizeof( map ) );
+		return;
+	}
+
+	for ( i = 0; i < 3; i++ )
+		if ( map_arg[ i ] )
+			parse_map( i, map_arg[ i ] );
+
+	cache_save( key, map, sizeof( map ) );
+}
+
 /** usage
  *
  * print help
@@ -145,13 +183,26 @@ usage ( void )
 	fprintf( stderr, "Usage: lsmi-mouse [options]\n"
 	"Options:\n\n"
 		" -h | --help                   Show this message\n"
-		" -d | --device specialfile     Event device to use (instead of event0)\n"
+		" -d | --device specialfile     Event device to use (instead of event0), or udp:port\n"
 		" -v | --verbose                Be verbose (show note events)\n"
 		" -p | --port client:port       Connect to ALSA Sequencer client on startup\n"					
 
 		" -1 | --button-one 'c'|'n':n:n     Button mapping\n"
 		" -2 | --button-two 'c'|'n':n:n     Button mapping\n"
-		" -3 | --button-thrree 'c'|'n':n:n  Button mapping\n" );
+		" -3 | --button-thrree 'c'|'n':n:n  Button mapping\n"
+		" -R | --realtime [rr:]rtprio   Use realtime priority 'rtprio' (requires privs)\n"
+		" -a | --affinity cpu           Pin event thread to 'cpu'\n"
+		" -b | --busy-poll              Spin waiting for input (for dedicated CPUs)\n"
+		" -T | --threaded               Write to ALSA from a separate output thread\n"
+		" -O | --output-affinity cpu    Pin output thread to 'cpu' (implies -T)\n"
+		" -S | --stats                  Print latency statistics on exit\n"
+		" -C | --control path           Accept commands on unix socket 'path'\n"
+		" -D | --dump-threshold uS      Dump flight recorder when latency exceeds 'uS'\n"
+		" -t | --tune report|apply      Find the device's IRQ; suggest or set IRQ and CPU affinity\n"
+		" -Q | --quantize n[:s[:w[:m]]] Snap notes to 1/n grid (strength %%, swing %%, max mS)\n"
+		" -B | --tempo bpm|clock[:c:p]  Grid tempo, or follow MIDI clock (from client:port)\n"
+		" -K | --cache file             Keep the compiled configuration in 'file'\n"
+		" -X | --takeover path          Take over from the driver at control socket 'path'\n" );
 	fprintf( stderr, 	" -z | --daemon                 Fork and don't print anything to stdout\n"
 	"\n" );
 }
@@ -162,7 +213,7 @@ usage ( void )
 void
 get_args ( int argc, char **argv )
 {
-	const char *short_opts = "hp:vd:1:2:3:z";
+	const char *short_opts = "hp:vd:1:2:3:R:a:bTO:SC:D:t:Q:B:K:X:z";
 	const struct option long_opts[] =
 	{
 		{ "help", no_argument, NULL, 'h' },
@@ -172,6 +223,19 @@ get_args ( int argc, char **argv )
 		{ "button-one", required_argument, NULL, '1' },
 		{ "button-two", required_argument, NULL, '2' },
 		{ "button-three", required_argument, NULL, '3' },
+		{ "realtime", required_argument, NULL, 'R' },
+		{ "affinity", required_argument, NULL, 'a' },
+		{ "busy-poll", no_argument, NULL, 'b' },
+		{ "threaded", no_argument, NULL, 'T' },
+		{ "output-affinity", required_argument, NULL, 'O' },
+		{ "stats", no_argument, NULL, 'S' },
+		{ "control", required_argument, NULL, 'C' },
+		{ "dump-threshold", required_argument, NULL, 'D' },
+		{ "tune", required_argument, NULL, 't' },
+		{ "quantize", required_argument, NULL, 'Q' },
+		{ "tempo", required_argument, NULL, 'B' },
+		{ "cache", required_argument, NULL, 'K' },
+		{ "takeover", required_argument, NULL, 'X' },
 		{ "daemon", no_argument, NULL, 'z' },
 		{ NULL, 0, NULL, 0 }
 	};
@@ -197,13 +261,59 @@ get_args ( int argc, char **argv )
 				device = optarg;
 				break;
 			case '1':
-				parse_map( 0, optarg );
+				map_arg[ 0 ] = optarg;
 				break;
 			case '2':
-				parse_map( 1, optarg );
+				map_arg[ 1 ] = optarg;
 				break;
 			case '3':
-				parse_map( 2, optarg );
+				map_arg[ 2 ] = optarg;
+				break;
+			case 'R':
+				if ( rt_parse_priority( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'a':
+				if ( ( rt_cpu = rt_parse_cpu( optarg ) ) < 0 )
+					exit( 1 );
+				break;
+			case 'b':
+				rt_busy = 1;
+				break;
+			case 'T':
+				threaded_output = 1;
+				break;
+			case 'O':
+				threaded_output = 1;
+				if ( ( output_cpu = rt_parse_cpu( optarg ) ) < 0 )
+					exit( 1 );
+				break;
+			case 'S':
+				stats_enabled = 1;
+				break;
+			case 'C':
+				ctl_path = optarg;
+				break;
+			case 'D':
+				rec_threshold = atol( optarg );
+				break;
+			case 't':
+				if ( tune_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'Q':
+				if ( quant_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'B':
+				if ( quant_tempo_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'K':
+				cache_file = optarg;
+				break;
+			case 'X':
+				takeover = optarg;
 				break;
 			case 'z':
 				daemonize = 1;
@@ -223,7 +333,21 @@ clean_up ( void )
 
  	close( fd );
 
+	stop_output_thread();
+
+	stop_input_thread();
+
+	quant_stop();
+
+	ctl_stop();
+
 	snd_seq_close( seq );
+
+	rt_release();
+
+	stats_report();
+
+	net_report();
 }
 
 /**
@@ -271,37 +395,61 @@ main ( int argc, char **argv )
 {
 	snd_seq_event_t ev;
 	struct input_event iev;
-	snd_seq_addr_t addr;
 
 	fprintf( stderr, "lsmi-mouse" " v" VERSION "\n" );
 
 	get_args( argc, argv );
 
-	fprintf( stderr, "Initializing mouse interface...\n" );
-
-	if ( -1 == ( fd = open( device, O_RDONLY ) ) )
+	if ( tune_mode )
 	{
-		fprintf( stderr, "Error opening event interface! (%s)\n", strerror( errno ) );
-		exit(1);
-	}
+		tune_device( device );
 
-	init_mouse();
+		if ( tune_mode == TUNE_REPORT )
+			exit( 0 );
+	}
 
 	fprintf( stderr, "Registering MIDI port...\n" );
 
-	seq = open_client( CLIENT_NAME  );
-	port = open_output_port( seq );
+	/* the mouse can be looked at while ALSA loads */
+	start_client_setup( CLIENT_NAME, sub_name );
 
-	if ( sub_name )
+	if ( ! takeover )
 	{
-		if ( snd_seq_parse_address( seq, &addr, sub_name ) < 0 )
-			fprintf( stderr, "Couldn't parse address '%s'", sub_name );
+		fprintf( stderr, "Initializing mouse interface...\n" );
+
+		if ( net_source( device ) )
+		{
+			/* checked and grabbed by the forwarder */
+			if ( -1 == ( fd = net_open( device ) ) )
+				exit( 1 );
+		}
 		else
-		if ( snd_seq_connect_to( seq, port, addr.client, addr.port ) < 0 )
 		{
-			fprintf( stderr, "Error creating subscription for port %i:%i", addr.client, addr.port );
-			exit( 1 );
+			if ( -1 == ( fd = open( device, O_RDONLY ) ) )
+			{
+				fprintf( stderr, "Error opening event interface! (%s)\n", strerror( errno ) );
+				exit(1);
+			}
+
+			init_mouse();
 		}
+
+		load_config( fd );
+	}
+
+	if ( finish_client_setup() < 0 )
+		exit( 1 );
+
+	/* the mouse is already grabbed; just pick it up */
+	if ( takeover )
+	{
+		if ( ctl_takeover( takeover, &fd, 1, NULL, 0 ) < 0 )
+			exit( 1 );
+
+		if ( net_source( device ) )
+			net_attach( fd );
+
+		load_config( fd );
 	}
 	
 	if ( daemonize )
@@ -318,13 +466,34 @@ main ( int argc, char **argv )
 
 	set_traps();
 
+	rt_setup();
+
+	if ( start_output_thread() < 0 )
+		exit( 1 );
+
+	if ( quant_start() < 0 )
+		exit( 1 );
+
+	if ( start_input_thread() < 0 )
+		exit( 1 );
+
+	if ( ctl_start() < 0 )
+		exit( 1 );
+
+	ctl_offer( &fd, 1, NULL, 0 );
+	ctl_confirm();
+
+	stats_startup();
+
 	fprintf( stderr, "Waiting for packets...\n" );
 
 	for ( ;; )
 	{
 		int i;
 
-		read( fd, &iev, sizeof( iev ) );
+		rt_read( fd, &iev, sizeof( iev ) );
+
+		rec_input( iev.type, iev.code, iev.value );
 
 		if ( iev.type != EV_KEY && iev.type != EV_REL)
 			continue;
@@ -58,9 +58,19 @@
 #include <stdint.h>
 
 #include <getopt.h>
+#include <glob.h>
 
 #include "seq.h"
 #include "sig.h"
+#include "rt.h"
+#include "stats.h"
+#include "rec.h"
+#include "ctl.h"
+#include "tune.h"
+#include "quant.h"
+#include "cache.h"
+#include "net.h"
+#include "pool.h"
 
 #define min(x,min) ( (x) < (min) ? (min) : (x) )
 #define max(x,max) ( (x) > (max) ? (max) : (x) )
@@ -79,10 +89,20 @@ int port = 0;
 snd_seq_t *seq = NULL;
 
 int daemonize = 0;
-int pgm = 0;
+
+#ifndef FIXED_MAP
+char *map_arg[ 3 ];								/* as given, until applied */
+#endif
 char defaultdevice[] = "/dev/input/event2";
 char *device = defaultdevice;
 
+/* multi-device mode */
+char *devices[ POOL_MAX_DEVICES ];
+int ndevices = 0;
+int nworkers = 0;
+int hotplug = 0;
+
+#ifndef FIXED_MAP
 /* button mapping */
 struct map_s {
 	int ev_type;
@@ -133,8 +153,42 @@ struct map_s map[22] = {
 	{ SND_SEQ_EVENT_PGMCHANGE, 1, 0 },
 	{ SND_SEQ_EVENT_PGMCHANGE, -1, 0 },
 };
+#endif
+
+#define CACHELINE 64
+
+/* per-pad state, one cache line each so that pads served by different
+ * workers never share one */
+struct pad {
+	int fd;											/* -1 == free */
+	int player;										/* 0 based */
+	int port;
+	int channel;
+	int pgm;
+} __attribute__(( aligned( CACHELINE ) ));
+
+struct pad pads[ POOL_MAX_DEVICES ];
+
+/* Player allocation. Each player gets the next free channel; every 16
+ * players get another port. */
+char player_taken[ POOL_MAX_DEVICES ];
+int player_ports[ POOL_MAX_DEVICES / 16 ];			/* -1 == not opened yet */
+
+#ifdef FIXED_MAP
 
-int fd;
+/* the mapping, compiled in by mkmap (make lsmi-ps3-fixed) */
+#include "ps3map.h"
+
+/**
+ * Nothing to load; the mapping is compiled in.
+ */
+void
+load_config ( int fd )
+{
+	fprintf( stderr, "Using mapping compiled in from '" MAP_NAME "'.\n" );
+}
+
+#else
 
 /**
  * Parse user supplied mapping argument 
@@ -168,6 +222,35 @@ parse_map ( int i, const char *s )
 		SND_SEQ_EVENT_CONTROLLER : SND_SEQ_EVENT_NOTEON;
 }
 
+/**
+ * Apply the mappings given on the command line (compiling them for
+ * /fd/'s device, or for any if -1), or their compiled form from the cache.
+ */
+void
+load_config ( int fd )
+{
+	uint64_t key = cache_key( map_arg, 3, fd );
+	const void *compiled;
+	int i;
+
+	/* and what they apply to, in case that changed with a new build */
+	key = cache_hash( key, map, sizeof( map ) );
+
+	if ( ( compiled = cache_load( key, sizeof( map ) ) ) )
+	{
+		memcpy( map, compiled, sizeof( map ) );
+		return;
+	}
+
+	for ( i = 0; i < 3; i++ )
+		if ( map_arg[ i ] )
+			parse_map( i, map_arg[ i ] );
+
+	cache_save( key, map, sizeof( map ) );
+}
+
+#endif
+
 /** usage
  *
  * print help
@@ -179,13 +262,34 @@ usage ( void )
 	fprintf( stderr, "Usage: lsmi-mouse [options]\n"
 	"Options:\n\n"
 		" -h | --help                   Show this message\n"
-		" -d | --device specialfile     Event device to use (instead of event0)\n"
+		" -d | --device specialfile     Event device to use (instead of event2), may be repeated\n"
+		"                               (or just once, udp:port)\n"
 		" -v | --verbose                Be verbose (show note events)\n"
 		" -p | --port client:port       Connect to ALSA Sequencer client on startup\n"					
 
+#ifndef FIXED_MAP
 		" -1 | --button-one 'c'|'n':n:n     Button mapping\n"
 		" -2 | --button-two 'c'|'n':n:n     Button mapping\n"
-		" -3 | --button-thrree 'c'|'n':n:n  Button mapping\n" );
+		" -3 | --button-thrree 'c'|'n':n:n  Button mapping\n"
+#endif
+		" -R | --realtime [rr:]rtprio   Use realtime priority 'rtprio' (requires privs)\n"
+		" -a | --affinity cpu           Pin event thread to 'cpu' (workers to 'cpu'+n)\n"
+		" -b | --busy-poll              Spin waiting for input (for dedicated CPUs)\n"
+		" -T | --threaded               Write to ALSA from a separate output thread\n"
+		" -O | --output-affinity cpu    Pin output thread to 'cpu' (implies -T)\n"
+		" -S | --stats                  Print latency statistics on exit\n"
+		" -C | --control path           Accept commands on unix socket 'path'\n"
+		" -D | --dump-threshold uS      Dump flight recorder when latency exceeds 'uS'\n"
+		" -t | --tune report|apply      Find the device's IRQ; suggest or set IRQ and CPU affinity\n"
+		" -Q | --quantize n[:s[:w[:m]]] Snap notes to 1/n grid (strength %%, swing %%, max mS)\n"
+		" -B | --tempo bpm|clock[:c:p]  Grid tempo, or follow MIDI clock (from client:port)\n"
+#ifndef FIXED_MAP
+		" -K | --cache file             Keep the compiled configuration in 'file'\n"
+#endif
+		" -w | --workers n              Share devices among 'n' worker threads\n"
+		" -H | --hotplug                Use every gamepad, including ones plugged in later\n"
+		" -M | --merge-window uS        Hold events 'uS' to write them in the order they happened\n"
+		" -F | --flood-limit n[:mute]   Let no pad send more than 'n' events/S (or mute it); implies -w 1\n" );
 	fprintf( stderr, 	" -z | --daemon                 Fork and don't print anything to stdout\n"
 	"\n" );
 }
@@ -196,16 +300,40 @@ usage ( void )
 void
 get_args ( int argc, char **argv )
 {
-	const char *short_opts = "hp:vd:1:2:3:z";
+#ifdef FIXED_MAP
+	const char *short_opts = "hp:vd:R:a:bTO:SC:D:t:Q:B:w:HM:F:z";
+#else
+	const char *short_opts = "hp:vd:1:2:3:R:a:bTO:SC:D:t:Q:B:K:w:HM:F:z";
+#endif
 	const struct option long_opts[] =
 	{
 		{ "help", no_argument, NULL, 'h' },
 		{ "port", required_argument, NULL, 'p' },
 		{ "verbose", no_argument, NULL, 'v' },
 		{ "device", required_argument, NULL, 'd' },
+#ifndef FIXED_MAP
 		{ "button-one", required_argument, NULL, '1' },
 		{ "button-two", required_argument, NULL, '2' },
 		{ "button-three", required_argument, NULL, '3' },
+#endif
+		{ "realtime", required_argument, NULL, 'R' },
+		{ "affinity", required_argument, NULL, 'a' },
+		{ "busy-poll", no_argument, NULL, 'b' },
+		{ "threaded", no_argument, NULL, 'T' },
+		{ "output-affinity", required_argument, NULL, 'O' },
+		{ "stats", no_argument, NULL, 'S' },
+		{ "control", required_argument, NULL, 'C' },
+		{ "dump-threshold", required_argument, NULL, 'D' },
+		{ "tune", required_argument, NULL, 't' },
+		{ "quantize", required_argument, NULL, 'Q' },
+		{ "tempo", required_argument, NULL, 'B' },
+#ifndef FIXED_MAP
+		{ "cache", required_argument, NULL, 'K' },
+#endif
+		{ "workers", required_argument, NULL, 'w' },
+		{ "hotplug", no_argument, NULL, 'H' },
+		{ "merge-window", required_argument, NULL, 'M' },
+		{ "flood-limit", required_argument, NULL, 'F' },
 		{ "daemon", no_argument, NULL, 'z' },
 		{ NULL, 0, NULL, 0 }
 	};
@@ -228,16 +356,81 @@ get_args ( int argc, char **argv )
 				verbose = 1;
 				break;
 			case 'd':
-				device = optarg;
+				if ( ndevices == POOL_MAX_DEVICES )
+				{
+					fprintf( stderr, "Too many devices!\n" );
+					exit( 1 );
+				}
+				device = devices[ ndevices++ ] = optarg;
 				break;
+#ifndef FIXED_MAP
 			case '1':
-				parse_map( 0, optarg );
+				map_arg[ 0 ] = optarg;
 				break;
 			case '2':
-				parse_map( 1, optarg );
+				map_arg[ 1 ] = optarg;
 				break;
 			case '3':
-				parse_map( 2, optarg );
+				map_arg[ 2 ] = optarg;
+				break;
+#endif
+			case 'R':
+				if ( rt_parse_priority( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'a':
+				if ( ( rt_cpu = rt_parse_cpu( optarg ) ) < 0 )
+					exit( 1 );
+				break;
+			case 'b':
+				rt_busy = 1;
+				break;
+			case 'T':
+				threaded_output = 1;
+				break;
+			case 'O':
+				threaded_output = 1;
+				if ( ( output_cpu = rt_parse_cpu( optarg ) ) < 0 )
+					exit( 1 );
+				break;
+			case 'S':
+				stats_enabled = 1;
+				break;
+			case 'C':
+				ctl_path = optarg;
+				break;
+			case 'D':
+				rec_threshold = atol( optarg );
+				break;
+			case 't':
+				if ( tune_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'Q':
+				if ( quant_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+			case 'B':
+				if ( quant_tempo_parse( optarg ) < 0 )
+					exit( 1 );
+				break;
+#ifndef FIXED_MAP
+			case 'K':
+				cache_file = optarg;
+				break;
+#endif
+			case 'w':
+				nworkers = atoi( optarg );
+				break;
+			case 'H':
+				hotplug = 1;
+				break;
+			case 'M':
+				merge_window = atol( optarg );
+				break;
+			case 'F':
+				if ( pool_flood_parse( optarg ) < 0 )
+					exit( 1 );
 				break;
 			case 'z':
 				daemonize = 1;
@@ -252,12 +445,34 @@ get_args ( int argc, char **argv )
 void
 clean_up ( void )
 {
-	/* release the mouse */
-	ioctl( fd, EVIOCGRAB, 0 );
+	int i;
 
- 	close( fd );
+	/* release the pads */
+	if ( nworkers )
+		pool_close();
+	else
+		for ( i = 0; i < POOL_MAX_DEVICES; i++ )
+			if ( pads[ i ].fd >= 0 )
+			{
+				ioctl( pads[ i ].fd, EVIOCGRAB, 0 );
+				close( pads[ i ].fd );
+			}
+
+	stop_output_thread();
+
+	stop_input_thread();
+
+	quant_stop();
+
+	ctl_stop();
 
 	snd_seq_close( seq );
+
+	rt_release();
+
+	stats_report();
+
+	net_report();
 }
 
 /**
@@ -271,29 +486,297 @@ die ( int sig )
 	exit( 1 );
 }
 
-/** 
- * Initialize event device for mouse. 
+/**
+ * Claim the lowest free player number and its port and channel for /pad/.
+ * Returns -1 if none are left.
+ */
+int
+alloc_player ( struct pad *pad )
+{
+	int i;
+
+	for ( i = 0; i < POOL_MAX_DEVICES; i++ )
+		if ( ! __atomic_exchange_n( &player_taken[ i ], 1, __ATOMIC_ACQ_REL ) )
+			break;
+
+	if ( i == POOL_MAX_DEVICES )
+		return -1;
+
+	if ( player_ports[ i / 16 ] < 0 )
+	{
+		char name[ 32 ];
+
+		sprintf( name, "Players %i-%i", i + 1, i + 16 );
+
+		if ( ( player_ports[ i / 16 ] = open_named_output_port( seq, name ) ) < 0 )
+		{
+			fprintf( stderr, "Error opening MIDI output port for player %i!\n", i + 1 );
+			player_ports[ i / 16 ] = -1;
+			__atomic_store_n( &player_taken[ i ], 0, __ATOMIC_RELEASE );
+			return -1;
+		}
+	}
+
+	pad->player = i;
+	pad->port = player_ports[ i / 16 ];
+	pad->channel = i % 16;
+
+	return 0;
+}
+
+/**
+ * Show player number of /pad/ (opened from /path/) on its LEDs, if it has
+ * any we recognize: sony1..4 (hid-sony) or player-1..4 (hid-playstation).
+ * Players 1 to 4 light the matching LED, the rest count in binary.
  */
 void
-init_mouse ( void )
+show_player ( struct pad *pad, const char *path )
+{
+	const char *node = strrchr( path, '/' );
+	char pattern[ 300 ];
+	glob_t g;
+	int i;
+
+	if ( ! node )
+		return;
+
+	snprintf( pattern, sizeof( pattern ),
+			  "/sys/class/input/%s/device/device/leds/*", node + 1 );
+
+	if ( glob( pattern, 0, NULL, &g ) )
+		return;
+
+	for ( i = 0; i < g.gl_pathc; i++ )
+	{
+		const char *name = strrchr( g.gl_pathv[ i ], '/' ) + 1;
+		const char *p;
+		char file[ 320 ];
+		FILE *fp;
+		int led, on;
+
+		if ( ( p = strstr( name, "::sony" ) ) )
+			led = atoi( p + 6 );
+		else
+		if ( ( p = strstr( name, ":player-" ) ) )
+			led = atoi( p + 8 );
+		else
+			continue;
+
+		if ( led < 1 || led > 4 )
+			continue;
+
+		if ( pad->player < 4 )
+			on = led == pad->player + 1;
+		else
+			on = ( pad->player + 1 ) & ( 1 << ( led - 1 ) );
+
+		snprintf( file, sizeof( file ), "%s/brightness", g.gl_pathv[ i ] );
+
+		if ( ( fp = fopen( file, "w" ) ) )
+		{
+			fprintf( fp, "%i\n", on ? 1 : 0 );
+			fclose( fp );
+		}
+	}
+
+	globfree( &g );
+}
+
+/** 
+ * Check that /fd/ (opened from /path/) is a gamepad and grab it. Returns its
+ * pad state, or NULL (complaining unless /quiet/) if it isn't one.
+ */
+void *
+init_pad ( int fd, const char *path, int quiet )
 {
   	uint8_t evt[EV_MAX / 8 + 1];
+  	uint8_t keys[KEY_MAX / 8 + 1];
+	struct pad *pad = NULL;
+	int i;
 
 	/* get capabilities */
+	memset( keys, 0, sizeof( keys ) );
 	ioctl( fd, EVIOCGBIT( 0, sizeof(evt)), evt );
+	ioctl( fd, EVIOCGBIT( EV_KEY, sizeof(keys)), keys );
 
-	if ( ! ( testbit( EV_KEY, evt ) &&
-			 testbit( EV_ABS, evt ) ) )
+	/* a forwarded pad has been checked and grabbed at the other end */
+	if ( ! net_owns( fd ) &&
+		 ! ( testbit( EV_KEY, evt ) &&
+			 testbit( EV_ABS, evt ) &&
+			 testbit( BTN_GAMEPAD, keys ) ) )
 	{
-		fprintf( stderr, "'%s' doesn't seem to be a mouse! look in /proc/bus/input/devices to find the name of your mouse's event device\n", device );
-		exit( 1 );
+		if ( ! quiet )
+			fprintf( stderr, "'%s' doesn't seem to be a gamepad! look in /proc/bus/input/devices to find the name of your controller's event device\n", path );
+		return NULL;
 	}
 
-	if ( ioctl( fd, EVIOCGRAB, 1 ) )
+	for ( i = 0; i < POOL_MAX_DEVICES; i++ )
+		if ( __atomic_load_n( &pads[ i ].fd, __ATOMIC_ACQUIRE ) < 0 )
+		{
+			pad = &pads[ i ];
+			break;
+		}
+
+	if ( ! pad )
+		return NULL;
+
+	if ( ! net_owns( fd ) && ioctl( fd, EVIOCGRAB, 1 ) )
 	{
-		perror( "EVIOCGRAB" );
-		exit(1);
+		if ( ! quiet )
+			perror( "EVIOCGRAB" );
+		return NULL;
 	}
+
+	if ( alloc_player( pad ) < 0 )
+	{
+		fprintf( stderr, "No more players available for '%s'!\n", path );
+		ioctl( fd, EVIOCGRAB, 0 );
+		return NULL;
+	}
+
+	pad->pgm = 0;
+	pad->fd = fd;
+
+	show_player( pad, path );
+
+	fprintf( stderr, "'%s' is player %i (port %i, channel %i).\n",
+			 path, pad->player + 1, pad->port, pad->channel + 1 );
+
+	return pad;
+}
+
+/**
+ * Release pad /ctx/
+ */
+void
+release_pad ( void *ctx )
+{
+	struct pad *pad = ctx;
+	snd_seq_event_t ev;
+
+	/* don't leave the player's notes hanging */
+	snd_seq_ev_clear( &ev );
+	snd_seq_ev_set_controller( &ev, pad->channel, 123, 0 );
+	send_event_from( pad->port, &ev );
+
+	ioctl( pad->fd, EVIOCGRAB, 0 );
+
+	__atomic_store_n( &player_taken[ pad->player ], 0, __ATOMIC_RELEASE );
+	__atomic_store_n( &pad->fd, -1, __ATOMIC_RELEASE );
+}
+
+/**
+ * Translate input event /iev/ from pad /ctx/ into MIDI
+ */
+void
+handle_event ( void *ctx, struct input_event *iev )
+{
+	struct pad *pad = ctx;
+	snd_seq_event_t ev;
+#ifndef FIXED_MAP
+	int i, channel;
+#endif
+
+	rec_input( iev->type, iev->code, iev->value );
+
+#ifdef FIXED_MAP
+	snd_seq_ev_clear( &ev );
+
+	if ( ! map_event( pad, iev, &ev ) )
+		return;
+#else
+	if ( iev->type != EV_KEY && iev->type != EV_ABS)
+		return;
+
+	switch ( iev->code )
+	{
+		//Buttons on/off
+		//Face buttons
+		case BTN_NORTH:		i = 0; break;
+		case BTN_SOUTH:	i = 1; break;
+		case BTN_EAST:		i = 2; break;
+		case BTN_WEST:      i = 3; break;
+		//dpad buttons
+		case BTN_DPAD_UP: i = 4; break;
+		case BTN_DPAD_DOWN: i = 5; break;
+		case BTN_DPAD_RIGHT: i = 6; break;
+		case BTN_DPAD_LEFT: i = 7; break;
+		//triggers
+		case BTN_TR: i = 8; break;
+		case BTN_TL: i = 9; break;
+		case BTN_TR2: i = 10; break;
+		case BTN_TL2: i = 11; break;
+		//sticks
+		case BTN_THUMBR: i = 12; break;
+		case BTN_THUMBL: i = 13; break;
+
+
+		//ABS values
+		//Sticks
+		case ABS_X: i = 14; break;
+		case ABS_Y: i = 15; break;
+		case ABS_RX: i = 16; break;
+		case ABS_RY: i = 17; break;
+
+		case ABS_Z: i = 18; break;
+		case ABS_RZ: i = 19; break;
+
+		case BTN_SELECT: i = 20; break;
+		case BTN_START: i = 21; break;
+
+
+			break;
+		default:
+			return;
+			break;
+	}
+
+	/* in multi-player mode each pad has a channel of its own */
+	channel = nworkers ? pad->channel : map[i].channel;
+
+	snd_seq_ev_clear( &ev );
+
+	switch ( ev.type = map[i].ev_type )
+	{
+	case SND_SEQ_EVENT_CONTROLLER:
+		snd_seq_ev_set_controller(&ev, channel, map[i].number, iev->value/2 );
+			break;
+	
+	case SND_SEQ_EVENT_PITCHBEND:
+			snd_seq_ev_set_pitchbend(&ev, channel,
+									(iev->value * 64) - 8192);
+			//snd_seq_ev_set_controller( &ev, map[i].channel,
+			//								map[i].number,
+			//								(iev->value*64) - 8192);
+			break;
+
+		case SND_SEQ_EVENT_NOTEON:
+			
+			snd_seq_ev_set_noteon( &ev, channel,
+										map[i].number,
+										iev->value == DOWN ? 127 : 0 );
+			break;
+		case SND_SEQ_EVENT_PGMCHANGE:
+			if (iev->value == 1) {
+				pad->pgm = pad->pgm + map[i].number;
+				if (pad->pgm > 127 || pad->pgm <= 0) {
+					pad->pgm = 0;
+				}
+				snd_seq_ev_set_pgmchange(&ev, channel, pad->pgm);
+			}
+			else {
+				return;
+			}
+			break;
+		default:
+			fprintf( stderr,
+					 "Internal error: unexpected mapping type %i !\n.", ev.type);
+			return;
+			break;
+	}
+#endif
+
+	send_event_from( pad->port, &ev );
 }
 
 
@@ -303,41 +786,110 @@ init_mouse ( void )
 int
 main ( int argc, char **argv )
 {
-	snd_seq_event_t ev;
 	struct input_event iev;
-	snd_seq_addr_t addr;
+	int i, fd;
 
-	fprintf( stderr, "lsmi-mouse" " v" VERSION "\n" );
+	fprintf( stderr, "lsmi-ps3" " v" VERSION "\n" );
+
+	for ( i = 0; i < POOL_MAX_DEVICES; i++ )
+		pads[ i ].fd = -1;
+
+	/* port numbers start at 0 */
+	for ( i = 0; i < POOL_MAX_DEVICES / 16; i++ )
+		player_ports[ i ] = -1;
 
 	get_args( argc, argv );
 
-	fprintf( stderr, "Initializing mouse interface...\n" );
+	if ( tune_mode )
+	{
+		for ( i = 0; i < ndevices; i++ )
+			tune_device( devices[ i ] );
+
+		if ( ! ndevices )
+			tune_device( device );
+
+		if ( tune_mode == TUNE_REPORT )
+			exit( 0 );
+	}
+
+	if ( ( ndevices > 1 || hotplug ) && ! nworkers )
+		nworkers = 1;
 
-	if ( -1 == ( fd = open( device, O_RDONLY ) ) )
+	/* budgets are kept by the workers, who can't read from the network */
+	if ( pool_rate && ! nworkers && net_source( device ) )
 	{
-		fprintf( stderr, "Error opening event interface! (%s)\n", strerror( errno ) );
-		exit(1);
+		fprintf( stderr, "-F is for pads read locally; ignored for '%s'.\n", device );
+		pool_rate = 0;
 	}
 
-	init_mouse();
+	if ( pool_rate && ! nworkers )
+	{
+		if ( ! ndevices )
+			devices[ ndevices++ ] = device;
+
+		nworkers = 1;
+	}
+
+	/* one device's events come in order already; only the workers
+	 * timestamp what they pass on */
+	if ( merge_window && ! nworkers )
+	{
+		fprintf( stderr, "-M only orders several pads' events; ignored for a single pad.\n" );
+		merge_window = 0;
+	}
 
 	fprintf( stderr, "Registering MIDI port...\n" );
 
-	seq = open_client( CLIENT_NAME  );
-	port = open_output_port( seq );
+	/* the gamepads can be looked at while ALSA loads */
+	start_client_setup( CLIENT_NAME, sub_name );
+
+	fprintf( stderr, "Initializing gamepad interface...\n" );
+
+	if ( nworkers )
+	{
+		load_config( -1 );
+
+		if ( finish_client_setup() < 0 )
+			exit( 1 );
 
-	if ( sub_name )
+		/* the first 16 players share the main port */
+		player_ports[ 0 ] = port;
+
+		if ( pool_init( nworkers, init_pad, handle_event, release_pad ) < 0 )
+			exit( 1 );
+
+		for ( i = 0; i < ndevices; i++ )
+			if ( pool_open( devices[ i ], 0 ) < 0 )
+				exit( 1 );
+
+		if ( hotplug )
+			fprintf( stderr, "Found %i gamepad(s).\n", pool_scan() + ndevices );
+	}
+	else
 	{
-		if ( snd_seq_parse_address( seq, &addr, sub_name ) < 0 )
-			fprintf( stderr, "Couldn't parse address '%s'", sub_name );
+		if ( net_source( device ) )
+		{
+			if ( -1 == ( fd = net_open( device ) ) )
+				exit( 1 );
+		}
 		else
-		if ( snd_seq_connect_to( seq, port, addr.client, addr.port ) < 0 )
+		if ( -1 == ( fd = open( device, O_RDONLY ) ) )
 		{
-			fprintf( stderr, "Error creating subscription for port %i:%i", addr.client, addr.port );
-			exit( 1 );
+			fprintf( stderr, "Error opening event interface! (%s)\n", strerror( errno ) );
+			exit(1);
 		}
+
+		load_config( fd );
+
+		if ( finish_client_setup() < 0 )
+			exit( 1 );
+
+		player_ports[ 0 ] = port;
+
+		if ( ! init_pad( fd, device, 0 ) )
+			exit( 1 );
 	}
-	
+
 	if ( daemonize )
 	{
 		printf( "Running as daemon...\n" );
@@ -352,102 +904,31 @@ main ( int argc, char **argv )
 
 	set_traps();
 
-	fprintf( stderr, "Waiting for packets...\n" );
+	rt_setup();
 
-	for ( ;; )
-	{
-		int i;
-
-		read( fd, &iev, sizeof( iev ) );
+	if ( start_output_thread() < 0 )
+		exit( 1 );
 
-		if ( iev.type != EV_KEY && iev.type != EV_ABS)
-			continue;
+	if ( quant_start() < 0 )
+		exit( 1 );
 
-		switch ( iev.code )
-		{
-			//Buttons on/off
-			//Face buttons
-			case BTN_NORTH:		i = 0; break;
-			case BTN_SOUTH:	i = 1; break;
-			case BTN_EAST:		i = 2; break;
-			case BTN_WEST:      i = 3; break;
-			//dpad buttons
-			case BTN_DPAD_UP: i = 4; break;
-			case BTN_DPAD_DOWN: i = 5; break;
-			case BTN_DPAD_RIGHT: i = 6; break;
-			case BTN_DPAD_LEFT: i = 7; break;
-			//triggers
-			case BTN_TR: i = 8; break;
-			case BTN_TL: i = 9; break;
-			case BTN_TR2: i = 10; break;
-			case BTN_TL2: i = 11; break;
-			//sticks
-			case BTN_THUMBR: i = 12; break;
-			case BTN_THUMBL: i = 13; break;
-
-
-			//ABS values
-			//Sticks
-			case ABS_X: i = 14; break;
-			case ABS_Y: i = 15; break;
-			case ABS_RX: i = 16; break;
-			case ABS_RY: i = 17; break;
-
-			case ABS_Z: i = 18; break;
-			case ABS_RZ: i = 19; break;
-
-			case BTN_SELECT: i = 20; break;
-			case BTN_START: i = 21; break;
+	if ( start_input_thread() < 0 )
+		exit( 1 );
 
+	if ( ctl_start() < 0 )
+		exit( 1 );
 
-				break;
-			default:
-				continue;
-				break;
-		}
+	stats_startup();
 
-		snd_seq_ev_clear( &ev );
+	fprintf( stderr, "Waiting for packets...\n" );
 
-		switch ( ev.type = map[i].ev_type )
-		{
-		case SND_SEQ_EVENT_CONTROLLER:
-			snd_seq_ev_set_controller(&ev, map[i].channel, map[i].number, iev.value/2 );
-				break;
-		
-		case SND_SEQ_EVENT_PITCHBEND:
-				snd_seq_ev_set_pitchbend(&ev, map[i].channel,
-										(iev.value * 64) - 8192);
-				//snd_seq_ev_set_controller( &ev, map[i].channel,
-				//								map[i].number,
-				//								(iev.value*64) - 8192);
-				break;
+	if ( nworkers )
+		pool_run( hotplug );
 
-			case SND_SEQ_EVENT_NOTEON:
-				
-				snd_seq_ev_set_noteon( &ev, map[i].channel,
-											map[i].number,
-											iev.value == DOWN ? 127 : 0 );
-				break;
-			case SND_SEQ_EVENT_PGMCHANGE:
-				if (iev.value == 1) {
-					pgm = pgm + map[i].number;
-					if (pgm > 127 || pgm <= 0) {
-						pgm = 0;
-					}
-					snd_seq_drain_output(seq);
-					snd_seq_ev_set_pgmchange(&ev, map[i].channel, pgm);
-				}
-				else {
-					continue;
-				}
-				break;
-			default:
-				fprintf( stderr,
-						 "Internal error: unexpected mapping type %i !\n.", ev.type);
-				continue;
-				break;
-		}
+	for ( ;; )
+	{
+		rt_read( pads[0].fd, &iev, sizeof( iev ) );
 
-		send_event( &ev );
+		handle_event( &pads[0], &iev );
 	}
 }
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2007 Jonathan Moore Liles
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General
+ * Public License for more details.
+ *
+ * You should have received a copy of the GNU General
+ * Public License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* mkmap.c
+ *
+ * Linux Pseudo MIDI Input -- Mapping Compiler
+ *
+ * This program reads a gamepad mapping file and writes C for lsmi-ps3 to be
+ * built with (see the lsmi-ps3-fixed target in the Makefile), so that on a
+ * small board the driver carries neither the mapping table nor anything to
+ * parse one with, just a switch with a constant case for each control that
+ * is used. It runs on the build machine, so it includes nothing of ALSA's or
+ * the kernel's; the code it writes uses their names.
+ *
+ * The mapping file has one control per line, followed by what it sends:
+ *
+ * 	# control	type:channel[:number]
+ * 	north		n:1:48		# note 48 on channel 1
+ * 	rx			c:1:80		# controller 80
+ * 	x			b:1			# pitch bend
+ * 	select		p:1:-1		# program down (or up, with a positive step)
+ * 	thumbl		-			# nothing at all
+ *
+ * Controls not mentioned send nothing either.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct control {
+	const char *name;
+	const char *code;								/* kernel's name */
+	int abs;										/* EV_ABS, not EV_KEY */
+	char type;										/* n, c, b or p; 0 == unused */
+	int channel;									/* 0 based */
+	int number;										/* note, controller or step */
+};
+
+/* in the order of lsmi-ps3's map[] */
+struct control controls[] = {
+	{ "north", "BTN_NORTH", 0, 0, 0, 0 },
+	{ "south", "BTN_SOUTH", 0, 0, 0, 0 },
+	{ "east", "BTN_EAST", 0, 0, 0, 0 },
+	{ "west", "BTN_WEST", 0, 0, 0, 0 },
+	{ "up", "BTN_DPAD_UP", 0, 0, 0, 0 },
+	{ "down", "BTN_DPAD_DOWN", 0, 0, 0, 0 },
+	{ "right", "BTN_DPAD_RIGHT", 0, 0, 0, 0 },
+	{ "left", "BTN_DPAD_LEFT", 0, 0, 0, 0 },
+	{ "tr", "BTN_TR", 0, 0, 0, 0 },
+	{ "tl", "BTN_TL", 0, 0, 0, 0 },
+	{ "tr2", "BTN_TR2", 0, 0, 0, 0 },
+	{ "tl2", "BTN_TL2", 0, 0, 0, 0 },
+	{ "thumbr", "BTN_THUMBR", 0, 0, 0, 0 },
+	{ "thumbl", "BTN_THUMBL", 0, 0, 0, 0 },
+	{ "x", "ABS_X", 1, 0, 0, 0 },
+	{ "y", "ABS_Y", 1, 0, 0, 0 },
+	{ "rx", "ABS_RX", 1, 0, 0, 0 },
+	{ "ry", "ABS_RY", 1, 0, 0, 0 },
+	{ "z", "ABS_Z", 1, 0, 0, 0 },
+	{ "rz", "ABS_RZ", 1, 0, 0, 0 },
+	{ "select", "BTN_SELECT", 0, 0, 0, 0 },
+	{ "start", "BTN_START", 0, 0, 0, 0 },
+	{ NULL, NULL, 0, 0, 0, 0 }
+};
+
+/**
+ * Return the control called /name/, or NULL
+ */
+struct control *
+find ( const char *name )
+{
+	struct control *c;
+
+	for ( c = controls; c->name; c++ )
+		if ( ! strcmp( c->name, name ) )
+			return c;
+
+	return NULL;
+}
+
+/**
+ * Read mapping file /path/ into controls[]. Exits (having complained) if it
+ * isn't right.
+ */
+void
+read_map ( const char *path )
+{
+	char line[ 256 ];
+	int n = 0;
+	FILE *fp;
+
+	if ( ! ( fp = fopen( path, "r" ) ) )
+	{
+		perror( path );
+		exit( 1 );
+	}
+
+	while ( fgets( line, sizeof( line ), fp ) )
+	{
+		char name[ 32 ], spec[ 32 ], type[ 2 ];
+		struct control *c;
+		int fields;
+
+		n++;
+
+		line[ strcspn( line, "#\n" ) ] = '\0';
+
+		if ( ( fields = sscanf( line, "%31s %31s", name, spec ) ) <= 0 )
+			continue;
+
+		if ( ! ( c = find( name ) ) )
+		{
+			fprintf( stderr, "%s:%i: No such control as '%s'!\n", path, n, name );
+			exit( 1 );
+		}
+
+		if ( c->type )
+		{
+			fprintf( stderr, "%s:%i: '%s' is mapped twice!\n", path, n, name );
+			exit( 1 );
+		}
+
+		if ( fields == 1 || ! strcmp( spec, "-" ) )
+			continue;
+
+		if ( sscanf( spec, "%1[ncbp]:%i:%i", type, &c->channel, &c->number ) <
+			 ( *spec == 'b' ? 2 : 3 ) )
+		{
+			fprintf( stderr, "%s:%i: Invalid mapping '%s'!\n", path, n, spec );
+			exit( 1 );
+		}
+
+		if ( c->channel < 1 || c->channel > 16 )
+		{
+			fprintf( stderr, "%s:%i: Channel numbers must be between 1 and 16!\n", path, n );
+			exit( 1 );
+		}
+
+		if ( *type != 'p' && *type != 'b' && ( c->number < 0 || c->number > 127 ) )
+		{
+			fprintf( stderr, "%s:%i: Controller and note numbers must be between 0 and 127!\n",
+					 path, n );
+			exit( 1 );
+		}
+
+		c->type = *type;
+		c->channel--;
+	}
+
+	fclose( fp );
+}
+
+/**
+ * Write the case for control /c/
+ */
+void
+write_case ( const struct control *c )
+{
+	char channel[ 64 ];
+
+	/* in multi-player mode each pad has a channel of its own */
+	sprintf( channel, "nworkers ? pad->channel : %i", c->channel );
+
+	printf( "\t\t\t\tcase %s:\n", c->code );
+
+	switch ( c->type )
+	{
+		case 'n':
+			printf( "\t\t\t\t\tsnd_seq_ev_set_noteon( ev, %s, %i,\n"
+					"\t\t\t\t\t\t\t\t\t\t   iev->value == DOWN ? 127 : 0 );\n",
+					channel, c->number );
+			break;
+		case 'c':
+			printf( "\t\t\t\t\tsnd_seq_ev_set_controller( ev, %s, %i,\n"
+					"\t\t\t\t\t\t\t\t\t\t\t   iev->value / 2 );\n",
+					channel, c->number );
+			break;
+		case 'b':
+			printf( "\t\t\t\t\tsnd_seq_ev_set_pitchbend( ev, %s,\n"
+					"\t\t\t\t\t\t\t\t\t\t\t  iev->value * 64 - 8192 );\n",
+					channel );
+			break;
+		case 'p':
+			printf( "\t\t\t\t\tif ( iev->value != DOWN )\n"
+					"\t\t\t\t\t\treturn 0;\n"
+					"\t\t\t\t\tpad->pgm += %i;\n"
+					"\t\t\t\t\tif ( pad->pgm > 127 || pad->pgm <= 0 )\n"
+					"\t\t\t\t\t\tpad->pgm = 0;\n"
+					"\t\t\t\t\tsnd_seq_ev_set_pgmchange( ev, %s, pad->pgm );\n",
+					c->number, channel );
+			break;
+	}
+
+	printf( "\t\t\t\t\treturn 1;\n" );
+}
+
+/**
+ * Write the cases for every mapped control of type /abs/, if there are any.
+ */
+void
+write_type ( int abs )
+{
+	const struct control *c;
+	int any = 0;
+
+	for ( c = controls; c->name; c++ )
+		if ( c->type && c->abs == abs )
+			any = 1;
+
+	if ( ! any )
+		return;
+
+	printf( "\t\tcase %s:\n"
+			"\t\t\tswitch ( iev->code )\n"
+			"\t\t\t{\n", abs ? "EV_ABS" : "EV_KEY" );
+
+	for ( c = controls; c->name; c++ )
+		if ( c->type && c->abs == abs )
+			write_case( c );
+
+	printf( "\t\t\t}\n"
+			"\t\t\tbreak;\n" );
+}
+
+/** main
+ *
+ */
+int
+main ( int argc, char **argv )
+{
+	if ( argc != 2 )
+	{
+		fprintf( stderr, "Usage: mkmap mapfile > header\n" );
+		exit( 1 );
+	}
+
+	read_map( argv[1] );
+
+	printf( "/* generated by mkmap from '%s'; edit that instead */\n\n", argv[1] );
+
+	printf( "#define MAP_NAME \"%s\"\n\n", argv[1] );
+
+	printf( "/**\n"
+			" * Translate input event /iev/ from pad /pad/ into /ev/. Returns 0 if\n"
+			" * there's nothing to send.\n"
+			" */\n"
+			"static int\n"
+			"map_event ( struct pad *pad, const struct input_event *iev,\n"
+			"\t\t\tsnd_seq_event_t *ev )\n"
+			"{\n"
+			"\tswitch ( iev->type )\n"
+			"\t{\n" );
+
+	write_type( 0 );
+	write_type( 1 );
+
+	printf( "\t}\n\n"
+			"\treturn 0;\n"
+			"}\n" );
+
+	return 0;
+}
@@ -0,0 +1,365 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <endian.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/input.h>
+
+#include "net.h"
+
+#define QUEUE_SIZE 1024								/* > KEY_CNT + ABS_CNT + 1 */
+#define RESYNC_RETRY 200							/* in milliseconds */
+
+/* the one network source a driver can have */
+static int nfd = -1;
+
+static struct input_event queue[ QUEUE_SIZE ];
+static int qhead, qtail;
+
+/* what we have told the driver so far, to work out a resync from */
+static unsigned char down[ KEY_CNT ];
+static int32_t abs_value[ ABS_CNT ];
+static unsigned char abs_known[ ABS_CNT ];
+
+static uint32_t expected;
+static int have_seq;
+static struct sockaddr_storage peer;
+static socklen_t peer_len;
+static struct timespec resync_asked;
+static int resync_pending;
+
+static unsigned long packets, lost, snapshots, stale;
+static double delay_total;
+static unsigned long delay_count;
+
+/**
+ * Is /device/ a network source (udp:[host:]port) rather than a device node?
+ */
+int
+net_source ( const char *device )
+{
+	return ! strncmp( device, "udp:", 4 );
+}
+
+/**
+ * Forget everything about the stream on /fd/, and make it the network source
+ */
+void
+net_attach ( int fd )
+{
+	nfd = fd;
+	qhead = qtail = 0;
+	have_seq = 0;
+	resync_pending = 0;
+
+	memset( down, 0, sizeof( down ) );
+	memset( abs_known, 0, sizeof( abs_known ) );
+}
+
+/**
+ * Listen for forwarded events on udp:[host:]port /device/. Returns the
+ * socket, to be read with rt_read() like any input device, or -1.
+ */
+int
+net_open ( const char *device )
+{
+	struct addrinfo hints, *ai;
+	char host[ 256 ];
+	const char *service;
+	int fd, err;
+
+	snprintf( host, sizeof( host ), "%s", device + 4 );
+
+	if ( ( service = strrchr( device + 4, ':' ) ) )
+	{
+		host[ service - ( device + 4 ) ] = '\0';
+		service++;
+	}
+	else
+	{
+		service = device + 4;
+		*host = '\0';
+	}
+
+	memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if ( ( err = getaddrinfo( *host ? host : NULL, service, &hints, &ai ) ) )
+	{
+		fprintf( stderr, "Bad network source '%s'! (%s)\n", device,
+				 gai_strerror( err ) );
+		return -1;
+	}
+
+	if ( -1 == ( fd = socket( ai->ai_family, SOCK_DGRAM, 0 ) ) ||
+		 bind( fd, ai->ai_addr, ai->ai_addrlen ) < 0 )
+	{
+		fprintf( stderr, "Error listening on '%s'! (%s)\n", device,
+				 strerror( errno ) );
+		freeaddrinfo( ai );
+		return -1;
+	}
+
+	freeaddrinfo( ai );
+
+	net_attach( fd );
+
+	fprintf( stderr, "Waiting for forwarded events on '%s'.\n", device );
+
+	return fd;
+}
+
+/**
+ * Hand event to the driver, keeping track of what it has been told
+ */
+static void
+push ( uint16_t type, uint16_t code, int32_t value, const struct timeval *tv )
+{
+	struct input_event *iev;
+
+	if ( type == EV_KEY && code < KEY_CNT )
+		down[ code ] = value != 0;
+	else
+	if ( type == EV_ABS && code < ABS_CNT )
+	{
+		abs_value[ code ] = value;
+		abs_known[ code ] = 1;
+	}
+
+	if ( qtail == QUEUE_SIZE )
+		return;
+
+	iev = &queue[ qtail++ ];
+
+	iev->input_event_sec = tv->tv_sec;
+	iev->input_event_usec = tv->tv_usec;
+	iev->type = type;
+	iev->code = code;
+	iev->value = value;
+}
+
+/**
+ * Ask the forwarder for a snapshot, unless we have just done so
+ */
+static void
+ask_resync ( void )
+{
+	struct net_packet req;
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+
+	if ( resync_pending &&
+		 ( now.tv_sec - resync_asked.tv_sec ) * 1000 +
+		 ( now.tv_nsec - resync_asked.tv_nsec ) / 1000000 < RESYNC_RETRY )
+		return;
+
+	memset( &req, 0, NET_HEADER_SIZE );
+	req.magic = htonl( NET_MAGIC );
+	req.seq = htonl( expected );
+	req.flags = htons( NET_RESYNC );
+
+	sendto( nfd, &req, NET_HEADER_SIZE, 0, (struct sockaddr *)&peer, peer_len );
+
+	resync_asked = now;
+	resync_pending = 1;
+}
+
+/**
+ * Bring the driver in line with snapshot /p/: release what isn't held any
+ * more, press what is, and move whatever axes have moved.
+ */
+static void
+apply_snapshot ( const struct net_packet *p, const struct timeval *tv )
+{
+	unsigned char held[ KEY_CNT ];
+	int i;
+
+	memset( held, 0, sizeof( held ) );
+
+	for ( i = 0; i < ntohs( p->count ); i++ )
+		if ( ntohs( p->ev[ i ].type ) == EV_KEY &&
+			 ntohs( p->ev[ i ].code ) < KEY_CNT )
+			held[ ntohs( p->ev[ i ].code ) ] = 1;
+
+	/* releases first, so nothing is played twice at once */
+	for ( i = 0; i < KEY_CNT; i++ )
+		if ( down[ i ] && ! held[ i ] )
+			push( EV_KEY, i, 0, tv );
+
+	for ( i = 0; i < KEY_CNT; i++ )
+		if ( held[ i ] && ! down[ i ] )
+			push( EV_KEY, i, 1, tv );
+
+	for ( i = 0; i < ntohs( p->count ); i++ )
+	{
+		uint16_t code = ntohs( p->ev[ i ].code );
+		int32_t value = ntohl( p->ev[ i ].value );
+
+		if ( ntohs( p->ev[ i ].type ) == EV_ABS && code < ABS_CNT &&
+			 ( ! abs_known[ code ] || abs_value[ code ] != value ) )
+			push( EV_ABS, code, value, tv );
+	}
+
+	if ( qtail > qhead )
+		push( EV_SYN, SYN_REPORT, 0, tv );
+
+	resync_pending = 0;
+	snapshots++;
+}
+
+/**
+ * Unpack the /n/ byte datagram at /p/ into the queue
+ */
+static void
+unpack ( const struct net_packet *p, ssize_t n )
+{
+	struct timeval tv, now;
+	uint64_t stamp;
+	uint32_t seq;
+	int32_t gap;
+	int i;
+
+	if ( n < NET_HEADER_SIZE || ntohl( p->magic ) != NET_MAGIC ||
+		 ntohs( p->count ) > NET_MAX_EVENTS ||
+		 n < NET_HEADER_SIZE + ntohs( p->count ) * sizeof( p->ev[0] ) )
+		return;
+
+	seq = ntohl( p->seq );
+
+	if ( have_seq && ( gap = seq - expected ) != 0 )
+	{
+		if ( gap < 0 )
+		{
+			/* overtaken; what it says is already out of date */
+			stale++;
+			return;
+		}
+
+		lost += gap;
+
+		if ( ! ( ntohs( p->flags ) & NET_SNAPSHOT ) )
+			ask_resync();
+	}
+
+	have_seq = 1;
+	expected = seq + 1;
+	packets++;
+
+	stamp = be64toh( p->stamp );
+
+	tv.tv_sec = stamp / 1000000;
+	tv.tv_usec = stamp % 1000000;
+
+	/* only means something if the clocks agree */
+	gettimeofday( &now, NULL );
+
+	if ( timercmp( &now, &tv, > ) )
+	{
+		delay_total += ( now.tv_sec - tv.tv_sec ) * 1000.0 +
+			( now.tv_usec - tv.tv_usec ) / 1000.0;
+		delay_count++;
+	}
+
+	if ( ntohs( p->flags ) & NET_SNAPSHOT )
+	{
+		apply_snapshot( p, &tv );
+		return;
+	}
+
+	for ( i = 0; i < ntohs( p->count ); i++ )
+		push( ntohs( p->ev[ i ].type ), ntohs( p->ev[ i ].code ),
+			  ntohl( p->ev[ i ].value ), &tv );
+}
+
+/**
+ * Is /fd/ the network source?
+ */
+int
+net_owns ( int fd )
+{
+	return fd >= 0 && fd == nfd;
+}
+
+/**
+ * Are there events from network source /fd/ waiting to be read?
+ */
+int
+net_pending ( int fd )
+{
+	return fd == nfd && qhead < qtail;
+}
+
+/**
+ * read() for network source /fd/: fills /buf/ with as many whole input
+ * events as fit, waiting for a datagram if there are none. Returns -1 if
+ * /fd/ isn't the network source.
+ */
+ssize_t
+net_read ( int fd, void *buf, size_t len )
+{
+	struct net_packet p;
+	size_t n;
+
+	if ( fd != nfd )
+	{
+		errno = EBADF;
+		return -1;
+	}
+
+	while ( qhead == qtail )
+	{
+		ssize_t r;
+
+		qhead = qtail = 0;
+
+		peer_len = sizeof( peer );
+
+		if ( ( r = recvfrom( fd, &p, sizeof( p ), 0, (struct sockaddr *)&peer,
+							 &peer_len ) ) < 0 )
+			return -1;
+
+		unpack( &p, r );
+	}
+
+	n = len / sizeof( queue[0] );
+
+	if ( n > qtail - qhead )
+		n = qtail - qhead;
+
+	memcpy( buf, &queue[ qhead ], n * sizeof( queue[0] ) );
+
+	qhead += n;
+
+	return n * sizeof( queue[0] );
+}
+
+/**
+ * Report on the network source, if there was one
+ */
+void
+net_report ( void )
+{
+	if ( nfd < 0 )
+		return;
+
+	fprintf( stderr, "Network input: %lu packets, %lu lost, %lu stale, %lu snapshots",
+			 packets, lost, stale, snapshots );
+
+	if ( delay_count )
+		fprintf( stderr, ", %.2fmS mean delay (if clocks agree)",
+				 delay_total / delay_count );
+
+	fprintf( stderr, ".\n" );
+}
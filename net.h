@@ -0,0 +1,39 @@
+
+#define NET_MAGIC 0x4e4d534c						/* "LSMN" */
+#define NET_MAX_EVENTS 128							/* keeps a packet under the MTU */
+
+#define NET_SNAPSHOT 1								/* full device state, not changes */
+#define NET_RESYNC 2								/* host -> forwarder: send one */
+
+/* One input event on the wire. Everything is in network byte order. */
+struct net_event {
+	uint16_t type;
+	uint16_t code;
+	int32_t value;
+};
+
+/* One datagram: the events up to and including a SYN_REPORT */
+struct net_packet {
+	uint32_t magic;
+	uint32_t seq;
+	uint64_t stamp;									/* of the report, in uS */
+	uint16_t flags;
+	uint16_t count;
+	struct net_event ev[ NET_MAX_EVENTS ];
+};
+
+#define NET_HEADER_SIZE ( offsetof( struct net_packet, ev ) )
+
+/* for kernel headers that predate 64 bit time on 32 bit machines */
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+int net_source __P(( const char *device ));
+int net_open __P(( const char *device ));
+void net_attach __P(( int fd ));
+int net_owns __P(( int fd ));
+int net_pending __P(( int fd ));
+ssize_t net_read __P(( int fd, void *buf, size_t len ));
+void net_report __P(( void ));
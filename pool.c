@@ -0,0 +1,836 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <alsa/asoundlib.h>
+
+#include "seq.h"
+#include "rt.h"
+#include "stats.h"
+#include "pool.h"
+
+#define INPUT_DIR "/dev/input"
+#define BATCH 64									/* events per read() */
+
+#define FLOOD_BURST 4								/* bucket holds 1/4 S of events */
+#define FLOOD_TICK 10								/* mS between looks at floods */
+#define FLOOD_CALM 1000								/* mS without running out */
+
+#define testbit(bit, array)    (array[bit/8] & (1<<(bit%8)))
+
+/* Each worker owns a shard of the devices, with its own epoll set and its
+ * own lane into the output queue. Only the owning worker ever touches a
+ * device's context, so no locking is needed; devices change hands only by
+ * the owner giving them away. */
+struct worker {
+	int index;
+	int epfd;
+	int cfd;										/* control eventfd */
+	int ndevs;
+	int move_to;									/* -1 == no move pending */
+	int flooding;									/* devices over budget */
+	pthread_t thread;
+};
+
+static struct pool_dev devs[ POOL_MAX_DEVICES ];
+static struct worker workers[ POOL_MAX_WORKERS ];
+static int nworkers;
+
+static pool_probe_f probe_cb;
+static pool_event_f event_cb;
+static pool_remove_f remove_cb;
+
+int pool_rate = 0;									/* events/S per device, 0 == any */
+int pool_mute = 0;									/* mute floods, don't just slow them */
+
+/**
+ * Parse flood limit /s/ (rate[:mute]). Returns -1 (having complained) if
+ * it's no good.
+ */
+int
+pool_flood_parse ( const char *s )
+{
+	char mute[ 8 ] = "";
+
+	if ( sscanf( s, "%i:%7s", &pool_rate, mute ) < 1 || pool_rate < 1 ||
+		 ( *mute && strcmp( mute, "mute" ) ) )
+	{
+		fprintf( stderr, "Flood limit must be events per second[:mute], "
+				 "e.g. 2000 or 500:mute!\n" );
+		return -1;
+	}
+
+	pool_mute = *mute != '\0';
+
+	return 0;
+}
+
+/**
+ * Set up /n/ workers (not yet running) and one output lane for each.
+ */
+int
+pool_init ( int n, pool_probe_f probe, pool_event_f event,
+			pool_remove_f remove )
+{
+	struct epoll_event ee;
+	int i;
+
+	if ( n < 1 || n > POOL_MAX_WORKERS )
+	{
+		fprintf( stderr, "Number of workers must be between 1 and %i!\n",
+				 POOL_MAX_WORKERS );
+		return -1;
+	}
+
+	nworkers = n;
+	probe_cb = probe;
+	event_cb = event;
+	remove_cb = remove;
+
+	for ( i = 0; i < POOL_MAX_DEVICES; i++ )
+		devs[ i ].fd = -1;
+
+	for ( i = 0; i < nworkers; i++ )
+	{
+		struct worker *w = &workers[ i ];
+
+		w->index = i;
+		w->move_to = -1;
+
+		if ( -1 == ( w->epfd = epoll_create1( 0 ) ) ||
+			 -1 == ( w->cfd = eventfd( 0, 0 ) ) )
+		{
+			fprintf( stderr, "Error creating worker %i! (%s)\n", i,
+					 strerror( errno ) );
+			return -1;
+		}
+
+		/* control events are the ones without a device */
+		ee.events = EPOLLIN;
+		ee.data.ptr = NULL;
+
+		epoll_ctl( w->epfd, EPOLL_CTL_ADD, w->cfd, &ee );
+	}
+
+	/* all workers feed the one output thread */
+	threaded_output = 1;
+	output_lanes = nworkers;
+
+	return 0;
+}
+
+/**
+ * Return the worker with the fewest devices
+ */
+static struct worker *
+least_loaded ( void )
+{
+	int i, best = 0;
+
+	for ( i = 1; i < nworkers; i++ )
+		if ( __atomic_load_n( &workers[ i ].ndevs, __ATOMIC_RELAXED ) <
+			 __atomic_load_n( &workers[ best ].ndevs, __ATOMIC_RELAXED ) )
+			best = i;
+
+	return &workers[ best ];
+}
+
+/**
+ * Hand device /d/ to worker /w/.
+ */
+static void
+attach ( struct pool_dev *d, struct worker *w )
+{
+	struct epoll_event ee;
+
+	ee.events = EPOLLIN;
+	ee.data.ptr = d;
+
+	__atomic_add_fetch( &w->ndevs, 1, __ATOMIC_RELAXED );
+
+	epoll_ctl( w->epfd, EPOLL_CTL_ADD, d->fd, &ee );
+
+	/* until this is set, /w/ will leave the device alone */
+	__atomic_store_n( &d->worker, w->index, __ATOMIC_RELEASE );
+}
+
+/**
+ * Start /d/ (open on /fd/) off with nothing held and its axes where they
+ * are, which is taken to be where they rest.
+ */
+static void
+remember_state ( struct pool_dev *d, int fd )
+{
+	uint8_t axes[ ABS_MAX / 8 + 1 ];
+	struct input_absinfo ai;
+	int i;
+
+	memset( d->held, 0, sizeof( d->held ) );
+	memset( d->abs, 0, sizeof( d->abs ) );
+	memset( axes, 0, sizeof( axes ) );
+
+	ioctl( fd, EVIOCGBIT( EV_ABS, sizeof( axes ) ), axes );
+
+	for ( i = 0; i < ABS_CNT; i++ )
+		if ( testbit( i, axes ) && ioctl( fd, EVIOCGABS( i ), &ai ) == 0 )
+			d->abs[ i ] = ai.value;
+
+	memcpy( d->rest, d->abs, sizeof( d->rest ) );
+}
+
+/**
+ * Open device node /path/ and, if the driver accepts it, give it to the
+ * least loaded worker. Returns -1 if the device was not added.
+ */
+int
+pool_open ( const char *path, int quiet )
+{
+	struct pool_dev *d = NULL;
+	int i, fd;
+
+	for ( i = 0; i < POOL_MAX_DEVICES; i++ )
+	{
+		if ( __atomic_load_n( &devs[ i ].fd, __ATOMIC_ACQUIRE ) < 0 )
+		{
+			if ( ! d )
+				d = &devs[ i ];
+		}
+		else
+		if ( ! strcmp( devs[ i ].path, path ) )
+			return -1;								/* already have it */
+	}
+
+	if ( ! d )
+	{
+		if ( ! quiet )
+			fprintf( stderr, "Too many devices, ignoring '%s'!\n", path );
+		return -1;
+	}
+
+	if ( -1 == ( fd = open( path, O_RDWR ) ) &&
+		 -1 == ( fd = open( path, O_RDONLY ) ) )
+	{
+		if ( ! quiet )
+			fprintf( stderr, "Error opening event interface '%s'! (%s)\n",
+					 path, strerror( errno ) );
+		return -1;
+	}
+
+	if ( ! ( d->ctx = probe_cb( fd, path, quiet ) ) )
+	{
+		close( fd );
+		return -1;
+	}
+
+	/* so that event times can be compared across devices and with ours */
+	if ( merge_window )
+	{
+		int clk = CLOCK_MONOTONIC;
+
+		if ( ioctl( fd, EVIOCSCLOCKID, &clk ) < 0 && ! quiet )
+			fprintf( stderr, "Can't have monotonic event times from '%s'; "
+					 "its events will be merged as they arrive.\n", path );
+	}
+
+	snprintf( d->path, sizeof( d->path ), "%s", path );
+
+	remember_state( d, fd );
+
+	d->tokens = pool_rate / FLOOD_BURST + 1;
+	clock_gettime( CLOCK_MONOTONIC, &d->filled );
+	d->flooding = d->muted = d->paused = d->dropped = 0;
+
+	d->worker = -1;
+	__atomic_store_n( &d->fd, fd, __ATOMIC_RELEASE );
+
+	attach( d, least_loaded() );
+
+	fprintf( stderr, "Added '%s' to worker %i.\n", path, d->worker );
+
+	return 0;
+}
+
+/**
+ * Try every event device in /dev/input. Returns the number added.
+ */
+int
+pool_scan ( void )
+{
+	struct dirent *de;
+	DIR *dir;
+	int n = 0;
+
+	if ( ! ( dir = opendir( INPUT_DIR ) ) )
+		return 0;
+
+	while ( ( de = readdir( dir ) ) )
+	{
+		char path[ 300 ];
+
+		if ( strncmp( de->d_name, "event", 5 ) )
+			continue;
+
+		snprintf( path, sizeof( path ), INPUT_DIR "/%s", de->d_name );
+
+		if ( pool_open( path, 1 ) == 0 )
+			n++;
+	}
+
+	closedir( dir );
+
+	return n;
+}
+
+/**
+ * Forget device /d/, which belongs to worker /w/ and has gone away.
+ */
+static void
+drop ( struct worker *w, struct pool_dev *d )
+{
+	fprintf( stderr, "Lost '%s'.\n", d->path );
+
+	if ( d->flooding )
+		w->flooding--;
+
+	remove_cb( d->ctx );
+
+	epoll_ctl( w->epfd, EPOLL_CTL_DEL, d->fd, NULL );
+	close( d->fd );
+
+	__atomic_sub_fetch( &w->ndevs, 1, __ATOMIC_RELAXED );
+	__atomic_store_n( &d->fd, -1, __ATOMIC_RELEASE );
+}
+
+/**
+ * Give one of worker /w/'s devices to the worker it has been asked to.
+ */
+static void
+give_away ( struct worker *w )
+{
+	struct worker *to = &workers[ w->move_to ];
+	int i;
+
+	for ( i = 0; i < POOL_MAX_DEVICES; i++ )
+	{
+		struct pool_dev *d = &devs[ i ];
+
+		/* a flooding device stays put until it calms down */
+		if ( d->fd < 0 || d->flooding ||
+			 __atomic_load_n( &d->worker, __ATOMIC_ACQUIRE ) != w->index )
+			continue;
+
+		epoll_ctl( w->epfd, EPOLL_CTL_DEL, d->fd, NULL );
+		__atomic_sub_fetch( &w->ndevs, 1, __ATOMIC_RELAXED );
+
+		attach( d, to );
+
+		break;
+	}
+
+	__atomic_store_n( &w->move_to, -1, __ATOMIC_RELEASE );
+}
+
+/**
+ * Pass input event /iev/ from device /d/ on to the driver, keeping track
+ * of what it holds. Whatever the driver sends for it is ordered by its
+ * timestamp, and anything sent afterwards by when it is sent.
+ */
+static void
+pass_on ( struct pool_dev *d, struct input_event *iev )
+{
+	if ( iev->type == EV_KEY && iev->code < KEY_CNT )
+	{
+		if ( iev->value )
+			d->held[ iev->code / 8 ] |= 1 << ( iev->code % 8 );
+		else
+			d->held[ iev->code / 8 ] &= ~( 1 << ( iev->code % 8 ) );
+	}
+	else
+	if ( iev->type == EV_ABS && iev->code < ABS_CNT )
+		d->abs[ iev->code ] = iev->value;
+
+	set_event_time( &iev->time );
+
+	event_cb( d->ctx, iev );
+
+	set_event_time( NULL );
+}
+
+/**
+ * Pass the driver an event of our own making for device /d/.
+ */
+static void
+pass_new ( struct pool_dev *d, int type, int code, int value )
+{
+	struct input_event iev;
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+
+	iev.time.tv_sec = now.tv_sec;
+	iev.time.tv_usec = now.tv_nsec / 1000;
+	iev.type = type;
+	iev.code = code;
+	iev.value = value;
+
+	pass_on( d, &iev );
+}
+
+/**
+ * Release everything device /d/ is holding down, and put its axes back at
+ * rest (triggers and sticks can be mapped to notes and controllers too), as
+ * far as the driver knows.
+ */
+static void
+release_held ( struct pool_dev *d )
+{
+	int i;
+
+	for ( i = 0; i < KEY_CNT; i++ )
+		if ( testbit( i, d->held ) )
+			pass_new( d, EV_KEY, i, 0 );
+
+	for ( i = 0; i < ABS_CNT; i++ )
+		if ( d->abs[ i ] != d->rest[ i ] )
+			pass_new( d, EV_ABS, i, d->rest[ i ] );
+
+	pass_new( d, EV_SYN, SYN_REPORT, 0 );
+}
+
+/**
+ * Bring the driver in line with the state of device /d/, after events have
+ * been lost or thrown away: release what isn't held any more, press what
+ * is, and move whatever axes have moved.
+ */
+static void
+resync ( struct pool_dev *d )
+{
+	uint8_t keys[ KEY_MAX / 8 + 1 ];
+	uint8_t axes[ ABS_MAX / 8 + 1 ];
+	struct input_absinfo ai;
+	int i;
+
+	memset( keys, 0, sizeof( keys ) );
+	memset( axes, 0, sizeof( axes ) );
+
+	/* a network source brings itself up to date */
+	if ( ioctl( d->fd, EVIOCGKEY( sizeof( keys ) ), keys ) < 0 )
+		return;
+
+	ioctl( d->fd, EVIOCGBIT( EV_ABS, sizeof( axes ) ), axes );
+
+	/* releases first, so nothing is played twice at once */
+	for ( i = 0; i < KEY_CNT; i++ )
+		if ( testbit( i, d->held ) && ! testbit( i, keys ) )
+			pass_new( d, EV_KEY, i, 0 );
+
+	for ( i = 0; i < KEY_CNT; i++ )
+		if ( testbit( i, keys ) && ! testbit( i, d->held ) )
+			pass_new( d, EV_KEY, i, 1 );
+
+	for ( i = 0; i < ABS_CNT; i++ )
+		if ( testbit( i, axes ) && ioctl( d->fd, EVIOCGABS( i ), &ai ) == 0 &&
+			 ai.value != d->abs[ i ] )
+			pass_new( d, EV_ABS, i, ai.value );
+
+	pass_new( d, EV_SYN, SYN_REPORT, 0 );
+
+	stats_resync();
+}
+
+/**
+ * Return the number of mS from /a/ to /b/
+ */
+static long
+ms_between ( const struct timespec *a, const struct timespec *b )
+{
+	return ( b->tv_sec - a->tv_sec ) * 1000 +
+		( b->tv_nsec - a->tv_nsec ) / 1000000;
+}
+
+/**
+ * Top up device /d/'s bucket for the time since it last was, as of /now/.
+ */
+static void
+refill ( struct pool_dev *d, const struct timespec *now )
+{
+	double burst = pool_rate / FLOOD_BURST + 1;
+
+	d->tokens += ( ( now->tv_sec - d->filled.tv_sec ) +
+				   ( now->tv_nsec - d->filled.tv_nsec ) / 1e9 ) * pool_rate;
+
+	if ( d->tokens > burst )
+		d->tokens = burst;
+
+	d->filled = *now;
+}
+
+/**
+ * Return the number of events device /d/ may be read for now.
+ */
+static int
+budget ( struct pool_dev *d )
+{
+	struct timespec now;
+
+	if ( ! pool_rate )
+		return BATCH;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+
+	refill( d, &now );
+
+	if ( d->tokens < 1 )
+		return 1;
+
+	return d->tokens < BATCH ? d->tokens : BATCH;
+}
+
+/**
+ * Stop polling device /d/ of worker /w/, which has spent its budget, until
+ * its bucket refills. The first time, flag it as flooding and, if asked
+ * to, mute it.
+ */
+static void
+starve ( struct worker *w, struct pool_dev *d )
+{
+	struct epoll_event ee;
+
+	/* no debts; the next pause measures how much it sends from here on */
+	if ( d->tokens < 0 )
+		d->tokens = 0;
+
+	d->starved = d->filled;
+
+	if ( ! d->flooding )
+	{
+		d->flooding = 1;
+		w->flooding++;
+
+		fprintf( stderr, "'%s' is flooding; %s it.\n", d->path,
+				 pool_mute ? "muting" : "throttling" );
+
+		stats_flood( pool_mute );
+
+		if ( pool_mute )
+		{
+			release_held( d );
+			d->muted = 1;
+		}
+	}
+
+	ee.events = 0;
+	ee.data.ptr = d;
+
+	epoll_ctl( w->epfd, EPOLL_CTL_MOD, d->fd, &ee );
+
+	d->paused = 1;
+}
+
+/**
+ * Poll device /d/ of worker /w/ again.
+ */
+static void
+resume ( struct worker *w, struct pool_dev *d )
+{
+	struct epoll_event ee;
+
+	ee.events = EPOLLIN;
+	ee.data.ptr = d;
+
+	epoll_ctl( w->epfd, EPOLL_CTL_MOD, d->fd, &ee );
+
+	d->paused = 0;
+}
+
+/**
+ * Throw away whatever device /d/ has waiting. Returns the number of events.
+ */
+static int
+drain ( struct pool_dev *d )
+{
+	struct input_event iev[ BATCH ];
+	struct pollfd pfd;
+	ssize_t r;
+	int n = 0;
+
+	pfd.fd = d->fd;
+	pfd.events = POLLIN;
+
+	while ( poll( &pfd, 1, 0 ) > 0 &&
+			( r = read( d->fd, iev, sizeof( iev ) ) ) > 0 )
+		n += r / sizeof( iev[0] );
+
+	return n;
+}
+
+/**
+ * Look in on worker /w/'s flooding devices: poll those whose buckets have
+ * refilled again, and let those that haven't run out for a while be heard.
+ */
+static void
+check_floods ( struct worker *w )
+{
+	struct timespec now;
+	int i;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+
+	for ( i = 0; i < POOL_MAX_DEVICES; i++ )
+	{
+		struct pool_dev *d = &devs[ i ];
+
+		if ( d->fd < 0 || ! d->flooding ||
+			 __atomic_load_n( &d->worker, __ATOMIC_ACQUIRE ) != w->index )
+			continue;
+
+		refill( d, &now );
+
+		if ( ms_between( &d->starved, &now ) >= FLOOD_CALM )
+		{
+			if ( d->paused )
+				resume( w, d );
+
+			if ( d->muted )
+			{
+				drain( d );
+				d->muted = 0;
+				resync( d );
+			}
+
+			d->flooding = 0;
+			w->flooding--;
+
+			fprintf( stderr, "'%s' has calmed down.\n", d->path );
+		}
+		else
+		if ( d->paused && ( d->tokens >= BATCH ||
+							d->tokens >= pool_rate / FLOOD_BURST ) )
+		{
+			/* what a muted device sent while paused only counts against it */
+			if ( d->muted && ( d->tokens -= drain( d ) ) < 1 )
+				starve( w, d );
+			else
+				resume( w, d );
+		}
+	}
+}
+
+/**
+ * Worker thread. Services its shard of devices.
+ */
+static void *
+worker_loop ( void *arg )
+{
+	struct worker *w = arg;
+	struct epoll_event ee[ 16 ];
+	struct input_event iev[ BATCH ];
+
+	set_output_lane( w->index );
+
+	if ( rt_cpu >= 0 && rt_pin( rt_cpu + w->index ) < 0 )
+		fprintf( stderr, "Couldn't pin worker %i to CPU %i! (%s)\n",
+				 w->index, rt_cpu + w->index, strerror( errno ) );
+
+	for ( ;; )
+	{
+		int i, n;
+
+		n = epoll_wait( w->epfd, ee, 16,
+						rt_busy ? 0 : w->flooding ? FLOOD_TICK : -1 );
+
+		if ( w->flooding )
+			check_floods( w );
+
+		for ( i = 0; i < n; i++ )
+		{
+			struct pool_dev *d = ee[ i ].data.ptr;
+			ssize_t r;
+			int j;
+
+			if ( ! d )
+			{
+				uint64_t v;
+
+				read( w->cfd, &v, sizeof( v ) );
+
+				if ( w->move_to >= 0 )
+					give_away( w );
+
+				continue;
+			}
+
+			/* given away earlier in this batch */
+			if ( d->fd < 0 ||
+				 __atomic_load_n( &d->worker, __ATOMIC_ACQUIRE ) != w->index )
+				continue;
+
+			if ( ee[ i ].events & ( EPOLLERR | EPOLLHUP ) )
+			{
+				drop( w, d );
+				continue;
+			}
+
+			/* paused since epoll_wait() returned */
+			if ( d->paused )
+				continue;
+
+			if ( ( r = rt_read( d->fd, iev, budget( d ) * sizeof( iev[0] ) ) ) <= 0 )
+			{
+				if ( r == 0 || errno != EINTR )
+					drop( w, d );
+				continue;
+			}
+
+			r /= sizeof( iev[0] );
+
+			for ( j = 0; j < r && ! d->muted; j++ )
+			{
+				/* the kernel's buffer overflowed; skip to the end of the
+				 * report and ask the device what it holds */
+				if ( iev[ j ].type == EV_SYN && iev[ j ].code == SYN_DROPPED )
+				{
+					d->dropped = 1;
+					continue;
+				}
+
+				if ( d->dropped )
+				{
+					if ( iev[ j ].type == EV_SYN && iev[ j ].code == SYN_REPORT )
+					{
+						d->dropped = 0;
+						resync( d );
+					}
+					continue;
+				}
+
+				pass_on( d, &iev[ j ] );
+			}
+
+			if ( pool_rate && ( d->tokens -= r ) < 1 )
+				starve( w, d );
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Even out the number of devices per worker, one move at a time.
+ */
+static void
+rebalance ( void )
+{
+	int i, lo = 0, hi = 0;
+
+	for ( i = 0; i < nworkers; i++ )
+		if ( __atomic_load_n( &workers[ i ].move_to, __ATOMIC_ACQUIRE ) >= 0 )
+			return;									/* one in flight */
+
+	for ( i = 1; i < nworkers; i++ )
+	{
+		if ( workers[ i ].ndevs < workers[ lo ].ndevs )
+			lo = i;
+		if ( workers[ i ].ndevs > workers[ hi ].ndevs )
+			hi = i;
+	}
+
+	if ( workers[ hi ].ndevs - workers[ lo ].ndevs > 1 )
+	{
+		uint64_t one = 1;
+
+		__atomic_store_n( &workers[ hi ].move_to, lo, __ATOMIC_RELEASE );
+
+		write( workers[ hi ].cfd, &one, sizeof( one ) );
+	}
+}
+
+/**
+ * Start the workers and become the manager: pick up hotplugged devices (if
+ * /hotplug/) and keep the shards balanced. Never returns.
+ */
+void
+pool_run ( int hotplug )
+{
+	struct pollfd pfd;
+	int i;
+
+	pfd.fd = -1;
+	pfd.events = POLLIN;
+
+	if ( hotplug &&
+		 -1 == ( pfd.fd = inotify_init1( 0 ) ) )
+		fprintf( stderr, "Couldn't watch for new devices! (%s)\n",
+				 strerror( errno ) );
+	else
+	if ( hotplug )
+		/* udev may only make the node readable after creating it */
+		inotify_add_watch( pfd.fd, INPUT_DIR, IN_CREATE | IN_ATTRIB );
+
+	for ( i = 0; i < nworkers; i++ )
+		if ( pthread_create( &workers[ i ].thread, NULL, worker_loop,
+							 &workers[ i ] ) )
+		{
+			fprintf( stderr, "Error starting worker %i!\n", i );
+			exit( 1 );
+		}
+
+	fprintf( stderr, "%i worker(s) running.\n", nworkers );
+
+	for ( ;; )
+	{
+		if ( poll( &pfd, 1, 1000 ) > 0 )
+		{
+			char buf[ 4096 ]
+				__attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+			ssize_t len = read( pfd.fd, buf, sizeof( buf ) );
+			char *p;
+
+			for ( p = buf; len > 0 && p < buf + len;
+				  p += sizeof( struct inotify_event ) +
+					  ( (struct inotify_event *)p )->len )
+			{
+				struct inotify_event *ie = (struct inotify_event *)p;
+				char path[ 300 ];
+
+				if ( ! ie->len || strncmp( ie->name, "event", 5 ) )
+					continue;
+
+				snprintf( path, sizeof( path ), INPUT_DIR "/%s", ie->name );
+
+				pool_open( path, 1 );
+			}
+		}
+
+		rebalance();
+	}
+}
+
+/**
+ * Release all devices
+ */
+void
+pool_close ( void )
+{
+	int i;
+
+	for ( i = 0; i < POOL_MAX_DEVICES; i++ )
+		if ( devs[ i ].fd >= 0 )
+		{
+			remove_cb( devs[ i ].ctx );
+			close( devs[ i ].fd );
+		}
+}
@@ -0,0 +1,39 @@
+
+#define POOL_MAX_DEVICES 64
+#define POOL_MAX_WORKERS 16
+
+/* called to accept (returning context) or reject (returning NULL) a newly
+ * opened device, to handle each of its events, and when it goes away */
+typedef void * (*pool_probe_f) __P(( int fd, const char *path, int quiet ));
+typedef void (*pool_event_f) __P(( void *ctx, struct input_event *iev ));
+typedef void (*pool_remove_f) __P(( void *ctx ));
+
+struct pool_dev {
+	int fd;											/* -1 == free slot */
+	int worker;										/* owning worker */
+	void *ctx;
+	char path[ 300 ];
+
+	/* the rest, like ctx, belongs to the owning worker */
+	double tokens;									/* events it may still send */
+	struct timespec filled;							/* when tokens were topped up */
+	struct timespec starved;						/* when it last ran out */
+	int flooding;
+	int muted;										/* events thrown away */
+	int paused;										/* not polled until refilled */
+	int dropped;									/* kernel lost events */
+	unsigned char held[ KEY_CNT / 8 + 1 ];			/* as passed on */
+	int abs[ ABS_CNT ];
+	int rest[ ABS_CNT ];							/* as opened */
+};
+
+extern int pool_rate;
+extern int pool_mute;
+
+int pool_flood_parse __P(( const char *s ));
+
+int pool_init __P(( int workers, pool_probe_f probe, pool_event_f event, pool_remove_f remove ));
+int pool_open __P(( const char *path, int quiet ));
+int pool_scan __P(( void ));
+void pool_run __P(( int hotplug ));
+void pool_close __P(( void ));
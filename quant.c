@@ -0,0 +1,408 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <alsa/asoundlib.h>
+
+#include "seq.h"
+#include "quant.h"
+
+#define PPQ 960										/* queue ticks per beat */
+#define CLOCK_TICKS ( PPQ / 24 )					/* per MIDI clock */
+
+extern snd_seq_t *seq;
+extern int verbose;
+
+int quant_division = 0;								/* grid lines per bar, 0 == off */
+int quant_strength = 100;							/* % of the way to the grid */
+int quant_swing = 0;								/* % of a step odd lines are late */
+int quant_max = 0;									/* mS, 0 == no limit */
+
+static double bpm = 120;
+static int follow_clock = 0;
+static const char *clock_from;
+
+static int queue = -1;
+
+/* where the music is minus where the queue is, in ticks; written by the
+ * input thread, read by whoever is sending */
+static long offset;
+static int rolling;									/* the grid means something */
+static unsigned int tempo;							/* uS per beat */
+
+/* how far each sounding note's on was put back, so its off can be too */
+static unsigned short shift[ 16 ][ 128 ];
+
+/**
+ * Parse grid spec /s/ (division[:strength[:swing[:max]]]). Returns -1 (having
+ * complained) if it's no good.
+ */
+int
+quant_parse ( const char *s )
+{
+	if ( sscanf( s, "%i:%i:%i:%i", &quant_division, &quant_strength,
+				 &quant_swing, &quant_max ) < 1 ||
+		 quant_division < 1 || quant_division > PPQ ||
+		 quant_strength < 0 || quant_strength > 100 ||
+		 quant_swing < 0 || quant_swing > 75 ||
+		 quant_max < 0 )
+	{
+		fprintf( stderr, "Quantization must be division[:strength%%[:swing%%[:max mS]]],\n"
+				 "e.g. 16 or 8:50:33:40!\n" );
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Parse tempo spec /s/ (bpm, or clock[:client:port]). Returns -1 (having
+ * complained) if it's no good.
+ */
+int
+quant_tempo_parse ( const char *s )
+{
+	if ( ! strncmp( s, "clock", 5 ) && ( s[5] == '\0' || s[5] == ':' ) )
+	{
+		follow_clock = 1;
+		clock_from = s[5] ? s + 6 : NULL;
+
+		return 0;
+	}
+
+	if ( ( bpm = atof( s ) ) < 20 || bpm > 400 )
+	{
+		fprintf( stderr, "Tempo must be 20 to 400 BPM, or 'clock'!\n" );
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Ask for the high resolution timer to drive our queue. Without it the
+ * queue only moves at every kernel tick (HZ), which is no good for this.
+ */
+static void
+use_hrtimer ( void )
+{
+	snd_seq_queue_timer_t *qt;
+	snd_timer_id_t *id;
+
+	snd_seq_queue_timer_alloca( &qt );
+	snd_timer_id_alloca( &id );
+
+	snd_timer_id_set_class( id, SND_TIMER_CLASS_GLOBAL );
+	snd_timer_id_set_sclass( id, SND_TIMER_SCLASS_NONE );
+	snd_timer_id_set_card( id, -1 );
+	snd_timer_id_set_device( id, SND_TIMER_GLOBAL_HRTIMER );
+	snd_timer_id_set_subdevice( id, 0 );
+
+	snd_seq_get_queue_timer( seq, queue, qt );
+	snd_seq_queue_timer_set_type( qt, SND_SEQ_TIMER_ALSA );
+	snd_seq_queue_timer_set_id( qt, id );
+
+	if ( snd_seq_set_queue_timer( seq, queue, qt ) < 0 )
+		fprintf( stderr, "No high resolution timer (is snd-hrtimer loaded?); "
+				 "quantization will only be as good as HZ.\n" );
+}
+
+/**
+ * Handle MIDI clock (and transport) event /ev/, which has been stamped with
+ * our queue's tick time on arrival. Called from the input thread.
+ */
+void
+quant_clock ( const snd_seq_event_t *ev )
+{
+	static unsigned long clocks;					/* since song position 0 */
+	static unsigned int beat_tick;					/* queue time of last beat */
+	static int have_beat;
+	static int playing;								/* clocks move the song on */
+	long o;
+
+	if ( queue < 0 || ! follow_clock )
+		return;
+
+	switch ( ev->type )
+	{
+		case SND_SEQ_EVENT_START:
+			clocks = 0;
+			have_beat = 0;
+			playing = 1;
+			break;
+		case SND_SEQ_EVENT_CONTINUE:
+			playing = 1;
+			break;
+		case SND_SEQ_EVENT_SONGPOS:
+			/* in sixteenths */
+			clocks = ev->data.control.value * 6;
+			have_beat = 0;
+			break;
+		case SND_SEQ_EVENT_STOP:
+			playing = 0;
+			__atomic_store_n( &rolling, 0, __ATOMIC_RELEASE );
+			break;
+		case SND_SEQ_EVENT_CLOCK:
+			/* until we know where in the song we are, there's no grid */
+			if ( ! playing )
+				break;
+
+			o = (long)clocks * CLOCK_TICKS - (long)ev->time.tick;
+
+			__atomic_store_n( &offset, o, __ATOMIC_RELAXED );
+			__atomic_store_n( &rolling, 1, __ATOMIC_RELEASE );
+
+			/* once a beat, bring our tempo into line with the clock's */
+			if ( clocks % 24 == 0 )
+			{
+				if ( have_beat && ev->time.tick != beat_tick )
+				{
+					double t = (double)tempo * ( ev->time.tick - beat_tick ) / PPQ;
+
+					if ( t > 60e6 / 400 && t < 60e6 / 20 &&
+						 (unsigned int)t != tempo )
+					{
+						tempo = t;
+
+						snd_seq_change_queue_tempo( seq, queue, tempo, NULL );
+						snd_seq_drain_output( seq );
+
+						if ( verbose )
+							printf( "Clock: %.1f BPM\n", 60e6 / tempo );
+					}
+				}
+
+				beat_tick = ev->time.tick;
+				have_beat = 1;
+			}
+
+			clocks++;
+			break;
+	}
+}
+
+/**
+ * Open the port MIDI clock is to arrive at, and have events there stamped
+ * with our queue's tick time. Returns -1 on failure.
+ */
+static int
+open_clock_port ( void )
+{
+	snd_seq_port_info_t *pi;
+	int clock_port;
+
+	snd_seq_port_info_alloca( &pi );
+
+	snd_seq_port_info_set_name( pi, "Clock" );
+	snd_seq_port_info_set_capability( pi, SND_SEQ_PORT_CAP_WRITE |
+									  SND_SEQ_PORT_CAP_SUBS_WRITE );
+	snd_seq_port_info_set_type( pi, SND_SEQ_PORT_TYPE_MIDI_GENERIC |
+								SND_SEQ_PORT_TYPE_APPLICATION );
+	snd_seq_port_info_set_timestamping( pi, 1 );
+	snd_seq_port_info_set_timestamp_real( pi, 0 );
+	snd_seq_port_info_set_timestamp_queue( pi, queue );
+
+	if ( snd_seq_create_port( seq, pi ) < 0 )
+		return -1;
+
+	clock_port = snd_seq_port_info_get_port( pi );
+
+	if ( clock_from )
+	{
+		snd_seq_addr_t addr;
+
+		if ( snd_seq_parse_address( seq, &addr, clock_from ) < 0 ||
+			 snd_seq_connect_from( seq, clock_port, addr.client, addr.port ) < 0 )
+			fprintf( stderr, "Couldn't get clock from '%s'!\n", clock_from );
+	}
+
+	return 0;
+}
+
+/**
+ * Start the queue the grid is kept on, and open a port for MIDI clock if
+ * asked to follow it (start_input_thread() reads it). Call once the client
+ * is open. Returns -1 (having complained) on failure.
+ */
+int
+quant_start ( void )
+{
+	snd_seq_queue_tempo_t *qt;
+
+	if ( ! quant_division )
+		return 0;
+
+	if ( ( queue = snd_seq_alloc_named_queue( seq, "Quantize" ) ) < 0 )
+	{
+		fprintf( stderr, "Error allocating sequencer queue!\n" );
+		return -1;
+	}
+
+	use_hrtimer();
+
+	tempo = 60e6 / bpm;
+
+	snd_seq_queue_tempo_alloca( &qt );
+
+	snd_seq_queue_tempo_set_tempo( qt, tempo );
+	snd_seq_queue_tempo_set_ppq( qt, PPQ );
+
+	if ( snd_seq_set_queue_tempo( seq, queue, qt ) < 0 )
+	{
+		fprintf( stderr, "Error setting queue tempo!\n" );
+		return -1;
+	}
+
+	snd_seq_start_queue( seq, queue, NULL );
+	snd_seq_drain_output( seq );
+
+	if ( follow_clock )
+	{
+		if ( open_clock_port() < 0 )
+		{
+			fprintf( stderr, "Error opening MIDI clock port!\n" );
+			return -1;
+		}
+
+		fprintf( stderr, "Quantizing to 1/%i once MIDI clock starts.\n",
+				 quant_division );
+	}
+	else
+	{
+		/* the grid starts with the queue */
+		rolling = 1;
+
+		fprintf( stderr, "Quantizing to 1/%i at %.1f BPM.\n",
+				 quant_division, bpm );
+	}
+
+	return 0;
+}
+
+/**
+ * Return grid line /k/, in ticks of music.
+ */
+static long
+line ( long k, long step )
+{
+	return k * step + ( k & 1 ? step * quant_swing / 100 : 0 );
+}
+
+/**
+ * Schedule note event /ev/ on our queue so that it lands on the grid (or
+ * as near to it as asked). Notes that are already late for a line, or too
+ * far from the next one, go out direct as ever. Note offs are put back as
+ * far as their note ons were. Anything else is left alone.
+ */
+void
+quant_event ( snd_seq_event_t *ev )
+{
+	snd_seq_queue_status_t *qs;
+	long now, pos, step, k, prev, next, d;
+	int c, n;
+
+	if ( queue < 0 || ! __atomic_load_n( &rolling, __ATOMIC_ACQUIRE ) )
+		return;
+
+	if ( ev->type != SND_SEQ_EVENT_NOTEON && ev->type != SND_SEQ_EVENT_NOTEOFF )
+		return;
+
+	c = ev->data.note.channel & 15;
+	n = ev->data.note.note & 127;
+
+	if ( ev->type == SND_SEQ_EVENT_NOTEOFF || ! ev->data.note.velocity )
+	{
+		if ( ( d = shift[ c ][ n ] ) )
+		{
+			shift[ c ][ n ] = 0;
+
+			snd_seq_ev_schedule_tick( ev, queue, 1, d );
+		}
+
+		return;
+	}
+
+	shift[ c ][ n ] = 0;
+
+	snd_seq_queue_status_alloca( &qs );
+
+	if ( snd_seq_get_queue_status( seq, queue, qs ) < 0 )
+		return;
+
+	now = snd_seq_queue_status_get_tick_time( qs );
+
+	if ( ( pos = now + __atomic_load_n( &offset, __ATOMIC_RELAXED ) ) < 0 )
+		return;
+
+	step = PPQ * 4 / quant_division;
+
+	/* find the lines either side (swing can put line k after us) */
+	k = pos / step;
+
+	if ( line( k, step ) > pos )
+	{
+		prev = line( k - 1, step );
+		next = line( k, step );
+	}
+	else
+	{
+		prev = line( k, step );
+		next = line( k + 1, step );
+	}
+
+	/* late for the last one; now is as close as we can get */
+	if ( pos - prev <= next - pos )
+		return;
+
+	d = ( next - pos ) * quant_strength / 100;
+
+	if ( d <= 0 || d > 0xffff ||
+		 ( quant_max && d * (long)tempo / PPQ > quant_max * 1000L ) )
+		return;
+
+	shift[ c ][ n ] = d;
+
+	snd_seq_ev_schedule_tick( ev, queue, 0, now + d );
+}
+
+/**
+ * Forget everything scheduled but not yet sent. Notes whose offs go with it
+ * are still counted as sounding, so release_notes() stops them.
+ */
+void
+quant_flush ( void )
+{
+	snd_seq_remove_events_t *re;
+
+	if ( queue < 0 )
+		return;
+
+	snd_seq_remove_events_alloca( &re );
+
+	snd_seq_remove_events_set_condition( re, SND_SEQ_REMOVE_OUTPUT );
+	snd_seq_remove_events_set_queue( re, queue );
+
+	snd_seq_remove_events( seq, re );
+
+	memset( shift, 0, sizeof( shift ) );
+}
+
+/**
+ * Stop quantizing, without leaving notes hanging. The output and input
+ * threads must not be running.
+ */
+void
+quant_stop ( void )
+{
+	if ( queue < 0 )
+		return;
+
+	quant_flush();
+
+	release_notes();
+
+	snd_seq_free_queue( seq, queue );
+
+	queue = -1;
+}
@@ -0,0 +1,13 @@
+
+extern int quant_division;
+extern int quant_strength;
+extern int quant_swing;
+extern int quant_max;
+
+int quant_parse __P(( const char *s ));
+int quant_tempo_parse __P(( const char *s ));
+int quant_start __P(( void ));
+void quant_event __P(( snd_seq_event_t *ev ));
+void quant_clock __P(( const snd_seq_event_t *ev ));
+void quant_flush __P(( void ));
+void quant_stop __P(( void ));
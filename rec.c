@@ -0,0 +1,264 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+
+#include "rec.h"
+
+/* The flight recorder is a ring of the last REC_SECONDS of events in and
+ * out (at up to REC_RATE a second), always running. Recording costs a clock
+ * read, an atomic increment and a handful of stores; nothing is ever
+ * formatted until someone asks for a dump. Each record carries its index,
+ * written last, so that a dump can tell a finished record from one that is
+ * being written (or has been overwritten) as it reads. */
+
+long rec_threshold = 0;								/* uS, 0 == never auto-dump */
+int rec_efd = -1;									/* dump requests */
+
+static struct rec fallback[ 1024 ];					/* if there's no memory for more */
+static struct rec *ring = fallback;
+static unsigned long mask = 1024 - 1;
+static unsigned long head;
+static int auto_pending;
+static int dumps;
+
+/**
+ * Make the ring big enough for REC_SECONDS of events, before main() gets
+ * going (and before memory is locked).
+ */
+static void __attribute__(( constructor ))
+rec_alloc ( void )
+{
+	unsigned long size;
+	struct rec *r;
+
+	for ( size = 1; size < (unsigned long)REC_SECONDS * REC_RATE; size <<= 1 )
+		;
+
+	if ( ( r = calloc( size, sizeof( *r ) ) ) )
+	{
+		ring = r;
+		mask = size - 1;
+	}
+}
+
+/**
+ * Set up the dump request eventfd. Returns -1 on failure.
+ */
+int
+rec_init ( void )
+{
+	if ( -1 == ( rec_efd = eventfd( 0, EFD_NONBLOCK ) ) )
+		return -1;
+
+	return 0;
+}
+
+static int64_t
+now_ns ( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Claim the next record, marking it as being written. Returns its index.
+ */
+static unsigned long
+claim ( struct rec **r )
+{
+	unsigned long i = __atomic_fetch_add( &head, 1, __ATOMIC_RELAXED );
+
+	*r = &ring[ i & mask ];
+
+	__atomic_store_n( &(*r)->seq, 0, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+
+	return i;
+}
+
+/**
+ * Mark record /r/, claimed as index /i/, as written.
+ */
+static void
+commit ( struct rec *r, unsigned long i )
+{
+	__atomic_store_n( &r->seq, i + 1, __ATOMIC_RELEASE );
+}
+
+/**
+ * Record a raw input event.
+ */
+void
+rec_input ( int type, int code, int value )
+{
+	struct rec *r;
+	unsigned long i = claim( &r );
+
+	r->ns = now_ns();
+	r->dir = REC_IN;
+	r->type = type;
+	r->code = code;
+	r->value = value;
+
+	commit( r, i );
+}
+
+/**
+ * Record an event sent to the sequencer.
+ */
+void
+rec_output ( const snd_seq_event_t *ev )
+{
+	struct rec *r;
+	unsigned long i = claim( &r );
+
+	r->ns = now_ns();
+	r->dir = REC_OUT;
+	r->type = ev->type;
+
+	switch ( ev->type )
+	{
+		case SND_SEQ_EVENT_NOTEON:
+		case SND_SEQ_EVENT_NOTEOFF:
+			r->channel = ev->data.note.channel;
+			r->code = ev->data.note.note;
+			r->value = ev->data.note.velocity;
+			break;
+		default:
+			r->channel = ev->data.control.channel;
+			r->code = ev->data.control.param;
+			r->value = ev->data.control.value;
+			break;
+	}
+
+	commit( r, i );
+}
+
+/**
+ * Ask for a dump. Safe to call from signal handlers and the event path.
+ * /automatic/ requests may be ignored if they come too often.
+ */
+void
+rec_trigger ( int automatic )
+{
+	uint64_t one = 1;
+
+	if ( automatic )
+		auto_pending = 1;
+
+	if ( rec_efd >= 0 )
+		write( rec_efd, &one, sizeof( one ) );
+}
+
+/**
+ * Collect pending dump request. Returns 0 if there was none, and sets
+ * /automatic/ if no request was a manual one.
+ */
+int
+rec_pending ( int *automatic )
+{
+	uint64_t n;
+
+	if ( read( rec_efd, &n, sizeof( n ) ) != sizeof( n ) )
+		return 0;
+
+	*automatic = __atomic_exchange_n( &auto_pending, 0, __ATOMIC_RELAXED ) &&
+		n == 1;
+
+	return 1;
+}
+
+/**
+ * Write the last REC_SECONDS of events to /filename/, or to a new file in
+ * /tmp if that's NULL. Input events are written as evemu "E:" lines, so a
+ * dump can be replayed onto a device with evemu-play; output events follow
+ * as comments. The name of the file written is copied into /name/. Returns
+ * -1 on failure.
+ */
+int
+rec_dump ( const char *filename, char *name, size_t len )
+{
+	unsigned long end = __atomic_load_n( &head, __ATOMIC_ACQUIRE );
+	unsigned long i = end > mask + 1 ? end - ( mask + 1 ) : 0;
+	int64_t since = now_ns() - (int64_t)REC_SECONDS * 1000000000;
+	int64_t first = 0;
+	unsigned long torn = 0;
+	FILE *fp;
+
+	if ( filename )
+		snprintf( name, len, "%s", filename );
+	else
+		snprintf( name, len, "/tmp/lsmi-%i-%i.rec", getpid(), ++dumps );
+
+	if ( ! ( fp = fopen( name, "w" ) ) )
+		return -1;
+
+	fprintf( fp, "# lsmi flight recorder, last %i seconds\n"
+			 "# E: <time> <type> <code> <value>     input (evemu)\n"
+			 "# O: <time> <type> <channel> <param> <value>     output (ALSA)\n",
+			 REC_SECONDS );
+
+	for ( ; i < end; i++ )
+	{
+		struct rec *slot = &ring[ i & mask ];
+		struct rec r;
+
+		if ( __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE ) != i + 1 )
+		{
+			torn++;
+			continue;
+		}
+
+		r = *slot;
+
+		/* still the same record, all the time we were copying it? */
+		__atomic_thread_fence( __ATOMIC_ACQUIRE );
+
+		if ( __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) != i + 1 )
+		{
+			torn++;
+			continue;
+		}
+
+		if ( r.ns < since )
+			continue;
+
+		if ( ! first )
+			first = r.ns;
+
+		r.ns -= first;
+
+		if ( r.dir == REC_IN )
+			fprintf( fp, "E: %lu.%06lu %04x %04x %d\n",
+					 (unsigned long)( r.ns / 1000000000 ),
+					 (unsigned long)( r.ns % 1000000000 / 1000 ),
+					 r.type, r.code, r.value );
+		else
+			fprintf( fp, "# O: %lu.%06lu %i %i %i %i\n",
+					 (unsigned long)( r.ns / 1000000000 ),
+					 (unsigned long)( r.ns % 1000000000 / 1000 ),
+					 r.type, r.channel, r.code, r.value );
+	}
+
+	if ( first && first > since && end > mask + 1 )
+		fprintf( fp, "# only the last %.1f seconds fit\n",
+				 ( now_ns() - first ) / 1e9 );
+
+	if ( torn )
+		fprintf( fp, "# %lu events skipped, being written as they were read\n",
+				 torn );
+
+	fclose( fp );
+
+	return 0;
+}
@@ -0,0 +1,27 @@
+
+#define REC_SECONDS 30								/* how far back a dump goes */
+#define REC_RATE 2000								/* events/S (in and out) it holds that long */
+
+#define REC_IN 'E'
+#define REC_OUT 'O'
+
+/* one recorded event, input or output */
+struct rec {
+	uint64_t seq;									/* index + 1 once written, else 0 */
+	int64_t ns;										/* CLOCK_MONOTONIC */
+	int32_t value;
+	uint16_t type;
+	uint16_t code;
+	unsigned char dir;
+	unsigned char channel;
+};
+
+extern long rec_threshold;
+extern int rec_efd;
+
+int rec_init __P(( void ));
+void rec_input __P(( int type, int code, int value ));
+void rec_output __P(( const snd_seq_event_t *ev ));
+void rec_trigger __P(( int automatic ));
+int rec_pending __P(( int *automatic ));
+int rec_dump __P(( const char *filename, char *name, size_t len ));
@@ -0,0 +1,290 @@
+
+#define _GNU_SOURCE								/* for ppoll() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+
+#include "ring.h"
+
+/**
+ * Wake the consumer, if it's asleep.
+ */
+void
+ring_wake ( struct ring *r )
+{
+	uint64_t one = 1;
+
+	if ( __atomic_load_n( &r->waiting, __ATOMIC_SEQ_CST ) )
+		write( r->efd, &one, sizeof( one ) );
+}
+
+/**
+ * Producer side. Queue event /ev/ (with input arrival time /stamp/ and input
+ * event time /when/) and wake the consumer. Yields while the ring is full
+ * rather than drop anything.
+ */
+void
+ring_push ( struct ring *r, const snd_seq_event_t *ev,
+			const struct timespec *stamp, const struct timespec *when )
+{
+	unsigned int head = r->head;
+	struct slot *s;
+
+	/* count the events that found it full, not the yields */
+	if ( head - __atomic_load_n( &r->tail, __ATOMIC_ACQUIRE ) >= RING_SIZE )
+	{
+		r->overruns++;
+
+		while ( head - __atomic_load_n( &r->tail, __ATOMIC_ACQUIRE ) >= RING_SIZE )
+			sched_yield();
+	}
+
+	s = &r->slot[ head & ( RING_SIZE - 1 ) ];
+
+	s->ev = *ev;
+	s->stamp = *stamp;
+	s->when = *when;
+
+	__atomic_store_n( &r->head, head + 1, __ATOMIC_SEQ_CST );
+
+	ring_wake( r );
+}
+
+/**
+ * Consumer side. Copy the oldest event into /s/. Returns 0 if the ring is
+ * empty.
+ */
+int
+ring_pop ( struct ring *r, struct slot *s )
+{
+	unsigned int tail = r->tail;
+
+	if ( tail == __atomic_load_n( &r->head, __ATOMIC_ACQUIRE ) )
+		return 0;
+
+	*s = r->slot[ tail & ( RING_SIZE - 1 ) ];
+
+	__atomic_store_n( &r->tail, tail + 1, __ATOMIC_RELEASE );
+
+	return 1;
+}
+
+/**
+ * Initialize queue pointed to by /q/ with /nlanes/ producer lanes. Returns -1
+ * on failure.
+ */
+int
+mpsc_init ( struct mpsc *q, int nlanes )
+{
+	int i;
+
+	q->nlanes = nlanes;
+	q->next = 0;
+
+	if ( posix_memalign( (void**)&q->lane, CACHELINE,
+						 nlanes * sizeof( struct ring ) ) )
+		return -1;
+
+	for ( i = 0; i < nlanes; i++ )
+	{
+		memset( &q->lane[ i ], 0, sizeof( struct ring ) );
+		q->lane[ i ].efd = -1;
+	}
+
+	if ( -1 == ( q->lane[ 0 ].efd = eventfd( 0, 0 ) ) )
+	{
+		free( q->lane );
+		q->lane = NULL;
+		return -1;
+	}
+
+	for ( i = 1; i < nlanes; i++ )
+		q->lane[ i ].efd = q->lane[ 0 ].efd;
+
+	return 0;
+}
+
+/**
+ * Producer side. Queue event on producer's own /lane/.
+ */
+void
+mpsc_push ( struct mpsc *q, int lane, const snd_seq_event_t *ev,
+			const struct timespec *stamp, const struct timespec *when )
+{
+	ring_push( &q->lane[ lane ], ev, stamp, when );
+}
+
+/**
+ * Consumer side. Take the next event from the lanes in round robin order.
+ * Returns 0 if all lanes are empty.
+ */
+int
+mpsc_pop ( struct mpsc *q, struct slot *s )
+{
+	int i;
+
+	for ( i = 0; i < q->nlanes; i++ )
+	{
+		struct ring *r = &q->lane[ q->next ];
+
+		q->next = q->next + 1 == q->nlanes ? 0 : q->next + 1;
+
+		if ( ring_pop( r, s ) )
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Consumer side. Sleep until any producer has pushed something.
+ */
+void
+mpsc_wait ( struct mpsc *q )
+{
+	mpsc_wait_until( q, NULL );
+}
+
+/**
+ * Consumer side. Sleep until any producer has pushed something or, unless
+ * it's NULL, the CLOCK_MONOTONIC time /deadline/ has passed.
+ */
+void
+mpsc_wait_until ( struct mpsc *q, const struct timespec *deadline )
+{
+	uint64_t n;
+	int i;
+
+	for ( i = 0; i < q->nlanes; i++ )
+		__atomic_store_n( &q->lane[ i ].waiting, 1, __ATOMIC_SEQ_CST );
+
+	for ( i = 0; i < q->nlanes; i++ )
+		if ( q->lane[ i ].tail !=
+			 __atomic_load_n( &q->lane[ i ].head, __ATOMIC_SEQ_CST ) )
+			break;
+
+	if ( i == q->nlanes )
+	{
+		struct pollfd pfd;
+		struct timespec now, left;
+
+		pfd.fd = q->lane[ 0 ].efd;
+		pfd.events = POLLIN;
+
+		if ( deadline )
+		{
+			clock_gettime( CLOCK_MONOTONIC, &now );
+
+			left.tv_sec = deadline->tv_sec - now.tv_sec;
+			left.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+
+			if ( left.tv_nsec < 0 )
+			{
+				left.tv_sec--;
+				left.tv_nsec += 1000000000;
+			}
+
+			if ( left.tv_sec < 0 )
+				left.tv_sec = left.tv_nsec = 0;
+		}
+
+		if ( ppoll( &pfd, 1, deadline ? &left : NULL, NULL ) > 0 )
+			read( q->lane[ 0 ].efd, &n, sizeof( n ) );
+	}
+
+	for ( i = 0; i < q->nlanes; i++ )
+		__atomic_store_n( &q->lane[ i ].waiting, 0, __ATOMIC_RELAXED );
+}
+
+/**
+ * Wake the consumer unconditionally (e.g. to have it notice a shutdown)
+ */
+void
+mpsc_kick ( struct mpsc *q )
+{
+	uint64_t one = 1;
+
+	write( q->lane[ 0 ].efd, &one, sizeof( one ) );
+}
+
+/**
+ * Does slot /a/ go before slot /b/?
+ */
+static int
+before ( const struct slot *a, const struct slot *b )
+{
+	if ( a->when.tv_sec != b->when.tv_sec )
+		return a->when.tv_sec < b->when.tv_sec;
+
+	if ( a->when.tv_nsec != b->when.tv_nsec )
+		return a->when.tv_nsec < b->when.tv_nsec;
+
+	return a->order < b->order;
+}
+
+/**
+ * Add slot /s/ to heap /h/, which must not be full.
+ */
+void
+heap_push ( struct heap *h, const struct slot *s )
+{
+	int i = h->count++;
+
+	/* sift up */
+	while ( i > 0 && before( s, &h->slot[ ( i - 1 ) / 2 ] ) )
+	{
+		h->slot[ i ] = h->slot[ ( i - 1 ) / 2 ];
+		i = ( i - 1 ) / 2;
+	}
+
+	h->slot[ i ] = *s;
+}
+
+/**
+ * Take the earliest slot from heap /h/ into /s/. Returns 0 if the heap is
+ * empty.
+ */
+int
+heap_pop ( struct heap *h, struct slot *s )
+{
+	struct slot *last;
+	int i = 0;
+
+	if ( ! h->count )
+		return 0;
+
+	*s = h->slot[ 0 ];
+
+	last = &h->slot[ --h->count ];
+
+	/* sift the last one down from the top */
+	for ( ;; )
+	{
+		int c = i * 2 + 1;
+
+		if ( c >= h->count )
+			break;
+
+		if ( c + 1 < h->count && before( &h->slot[ c + 1 ], &h->slot[ c ] ) )
+			c++;
+
+		if ( ! before( &h->slot[ c ], last ) )
+			break;
+
+		h->slot[ i ] = h->slot[ c ];
+		i = c;
+	}
+
+	h->slot[ i ] = *last;
+
+	return 1;
+}
@@ -0,0 +1,56 @@
+
+#define CACHELINE 64
+#define RING_SIZE 1024								/* must be a power of two */
+
+/* an output event, the time its input arrived and the time that input
+ * happened (by the kernel's clock) */
+struct slot {
+	snd_seq_event_t ev;
+	struct timespec stamp;
+	struct timespec when;
+	unsigned long order;							/* consumer's arrival count */
+};
+
+/* Single producer, single consumer ring. Each index lives on its own cache
+ * line so the two threads never write to the same one. */
+struct ring {
+	unsigned int head __attribute__(( aligned( CACHELINE ) ));	/* producer */
+	unsigned int tail __attribute__(( aligned( CACHELINE ) ));	/* consumer */
+	int waiting __attribute__(( aligned( CACHELINE ) ));		/* consumer asleep */
+	int efd;
+	unsigned long overruns;
+	struct slot slot[ RING_SIZE ] __attribute__(( aligned( CACHELINE ) ));
+};
+
+void ring_push __P(( struct ring *r, const snd_seq_event_t *ev, const struct timespec *stamp, const struct timespec *when ));
+int ring_pop __P(( struct ring *r, struct slot *s ));
+void ring_wake __P(( struct ring *r ));
+
+/* Multiple producer, single consumer queue made of one SPSC ring (lane) per
+ * producer thread, all sharing one eventfd. Producers never contend, so
+ * pushing is wait-free as long as the producer's own lane has room. */
+struct mpsc {
+	int nlanes;
+	int next;										/* consumer's round robin */
+	struct ring *lane;
+};
+
+int mpsc_init __P(( struct mpsc *q, int nlanes ));
+void mpsc_push __P(( struct mpsc *q, int lane, const snd_seq_event_t *ev, const struct timespec *stamp, const struct timespec *when ));
+int mpsc_pop __P(( struct mpsc *q, struct slot *s ));
+void mpsc_wait __P(( struct mpsc *q ));
+void mpsc_wait_until __P(( struct mpsc *q, const struct timespec *deadline ));
+void mpsc_kick __P(( struct mpsc *q ));
+
+#define HEAP_SIZE 256
+
+/* Min-heap of slots, earliest /when/ first (and, between equals, in the order
+ * they were taken from the queue), for putting events read from several
+ * devices back into the order they happened in. Consumer side only. */
+struct heap {
+	int count;
+	struct slot slot[ HEAP_SIZE ];
+};
+
+void heap_push __P(( struct heap *h, const struct slot *s ));
+int heap_pop __P(( struct heap *h, struct slot *s ));
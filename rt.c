@@ -0,0 +1,324 @@
+
+#define _GNU_SOURCE								/* for CPU affinity */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+#include "stats.h"
+#include "ctl.h"
+#include "net.h"
+
+extern long rec_threshold;							/* rec.c */
+extern long merge_window;							/* seq.c */
+
+/* prefault this much stack before locking, so the event loop never faults */
+#define STACK_PREFAULT ( 64 * 1024 )
+
+int rt_policy = SCHED_FIFO;
+int rt_priority = 0;								/* 0 == don't go realtime */
+int rt_cpu = -1;									/* -1 == don't pin */
+int rt_busy = 0;									/* busy-poll input */
+
+static int dma_fd = -1;								/* held while running */
+
+/**
+ * Parse realtime argument of the form [fifo:|rr:]priority
+ */
+int
+rt_parse_priority ( const char *s )
+{
+	if ( ! strncmp( s, "fifo:", 5 ) )
+	{
+		rt_policy = SCHED_FIFO;
+		s += 5;
+	}
+	else
+	if ( ! strncmp( s, "rr:", 3 ) )
+	{
+		rt_policy = SCHED_RR;
+		s += 3;
+	}
+
+	rt_priority = atoi( s );
+
+	if ( rt_priority < sched_get_priority_min( rt_policy ) ||
+		 rt_priority > sched_get_priority_max( rt_policy ) )
+	{
+		fprintf( stderr, "Realtime priority must be between %i and %i!\n",
+				 sched_get_priority_min( rt_policy ),
+				 sched_get_priority_max( rt_policy ) );
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Parse CPU number /s/. Returns it, or -1 (having complained) if there's no
+ * such CPU.
+ */
+int
+rt_parse_cpu ( const char *s )
+{
+	long ncpus = sysconf( _SC_NPROCESSORS_CONF );
+	char *end;
+	long cpu;
+
+	cpu = strtol( s, &end, 10 );
+
+	if ( end == s || *end || cpu < 0 || cpu >= CPU_SETSIZE ||
+		 ( ncpus > 0 && cpu >= ncpus ) )
+	{
+		fprintf( stderr, "CPU must be a number between 0 and %li!\n",
+				 ( ncpus > 0 ? ncpus : CPU_SETSIZE ) - 1 );
+		return -1;
+	}
+
+	return cpu;
+}
+
+/**
+ * Touch /STACK_PREFAULT/ bytes of stack so they're resident before mlockall.
+ */
+static void
+prefault_stack ( void )
+{
+	volatile unsigned char buf[ STACK_PREFAULT ];
+	int i;
+
+	for ( i = 0; i < sizeof( buf ); i += 4096 )
+		buf[ i ] = 0;
+}
+
+/**
+ * Pin the calling thread to /cpu/. Returns 0 on success.
+ */
+int
+rt_pin ( int cpu )
+{
+	cpu_set_t set;
+
+	if ( cpu < 0 )
+		return 0;
+
+	CPU_ZERO( &set );
+	CPU_SET( cpu, &set );
+
+	return sched_setaffinity( 0, sizeof( set ), &set );
+}
+
+/**
+ * Apply whatever realtime settings were requested on the command line to the
+ * calling (event) thread. Must be called after any fork(), since memory
+ * locks are not inherited. Reports each setting that could not be applied
+ * and returns the number of failures.
+ */
+int
+rt_setup ( void )
+{
+	int failed = 0;
+
+	if ( rt_cpu >= 0 )
+	{
+		if ( rt_pin( rt_cpu ) < 0 )
+		{
+			fprintf( stderr, "Couldn't pin event thread to CPU %i! (%s)\n",
+					 rt_cpu, strerror( errno ) );
+			failed++;
+		}
+		else
+			fprintf( stderr, "Event thread pinned to CPU %i.\n", rt_cpu );
+	}
+
+	if ( ! rt_priority )
+		goto done;
+
+	{
+		struct sched_param sp;
+
+		sp.sched_priority = rt_priority;
+
+		if ( sched_setscheduler( 0, rt_policy, &sp ) < 0 )
+		{
+			fprintf( stderr, "Failed to get realtime priority! (%s)\n",
+					 strerror( errno ) );
+			failed++;
+		}
+		else
+			fprintf( stderr, "Using realtime priority %s:%i.\n",
+					 rt_policy == SCHED_RR ? "rr" : "fifo", rt_priority );
+	}
+
+	prefault_stack();
+
+	if ( mlockall( MCL_CURRENT | MCL_FUTURE ) < 0 )
+	{
+		fprintf( stderr, "Couldn't lock memory! (%s)\n", strerror( errno ) );
+		failed++;
+	}
+	else
+		fprintf( stderr, "Memory locked.\n" );
+
+	/* the kernel honors our request only as long as the file is open */
+	if ( -1 == ( dma_fd = open( "/dev/cpu_dma_latency", O_WRONLY ) ) )
+	{
+		fprintf( stderr, "Couldn't open /dev/cpu_dma_latency! (%s)\n",
+				 strerror( errno ) );
+		failed++;
+	}
+	else
+	{
+		int32_t lat = 0;
+
+		if ( write( dma_fd, &lat, sizeof( lat ) ) != sizeof( lat ) )
+		{
+			fprintf( stderr, "Couldn't set PM QoS CPU latency! (%s)\n",
+					 strerror( errno ) );
+			close( dma_fd );
+			dma_fd = -1;
+			failed++;
+		}
+		else
+			fprintf( stderr, "Holding CPU DMA latency at 0uS.\n" );
+	}
+
+done:
+
+	if ( rt_busy )
+		fprintf( stderr, "Busy-polling for input%s.\n",
+				 rt_cpu < 0 ? " (without a dedicated CPU!)" : "" );
+
+	if ( failed )
+		fprintf( stderr, "%i realtime setting(s) could not be applied.\n",
+				 failed );
+
+	return failed;
+}
+
+/**
+ * Release PM QoS request
+ */
+void
+rt_release ( void )
+{
+	if ( dma_fd >= 0 )
+		close( dma_fd );
+
+	dma_fd = -1;
+}
+
+/**
+ * read() wrapper for the event loops. Spins instead of sleeping when
+ * busy-polling, notes the arrival time for the latency statistics, and parks
+ * the thread when asked to for a handover. Reads from a network source are
+ * passed to net_read().
+ */
+ssize_t
+rt_read ( int fd, void *buf, size_t len )
+{
+	ssize_t r;
+
+	for ( ;; )
+	{
+		if ( rt_busy && ! net_pending( fd ) )
+		{
+			struct pollfd pfd;
+
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+
+			while ( poll( &pfd, 1, 0 ) == 0 && ! ctl_parking )
+				;
+		}
+
+		if ( ! ctl_parking )
+		{
+			if ( net_owns( fd ) )
+				r = net_read( fd, buf, len );
+			else
+				r = read( fd, buf, len );
+
+			if ( r >= 0 || errno != EINTR || ! ctl_parking )
+				break;
+		}
+
+		ctl_park();
+	}
+
+	/* only latency figures, recorder triggers and merging need to know */
+	if ( stats_enabled || rec_threshold || merge_window )
+		stats_mark();
+
+	return r;
+}
+
+/**
+ * select() wrapper for the event loops. Spins instead of sleeping when
+ * busy-polling, honoring /tv/ (which may be NULL) as a deadline. Parks the
+ * thread when asked to, like rt_read().
+ */
+int
+rt_select ( int nfds, fd_set *rfds, struct timeval *tv )
+{
+	struct timeval zero, start, now;
+	fd_set set;
+	int r;
+
+	if ( ! rt_busy )
+	{
+		set = *rfds;
+
+		while ( ctl_parking ||
+				( ( r = select( nfds, rfds, NULL, NULL, tv ) ) < 0 &&
+				  errno == EINTR && ctl_parking ) )
+		{
+			ctl_park();
+			*rfds = set;
+		}
+
+		return r;
+	}
+
+	gettimeofday( &start, NULL );
+
+	for ( ;; )
+	{
+		set = *rfds;
+
+		zero.tv_sec = zero.tv_usec = 0;
+
+		if ( ctl_parking )
+		{
+			ctl_park();
+			continue;
+		}
+
+		if ( ( r = select( nfds, &set, NULL, NULL, &zero ) ) )
+			break;
+
+		if ( tv )
+		{
+			gettimeofday( &now, NULL );
+
+			if ( ( now.tv_sec - start.tv_sec ) * 1000000 +
+				 ( now.tv_usec - start.tv_usec ) >=
+				 tv->tv_sec * 1000000 + tv->tv_usec )
+				break;
+		}
+	}
+
+	*rfds = set;
+
+	return r;
+}
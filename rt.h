@@ -0,0 +1,13 @@
+
+extern int rt_policy;
+extern int rt_priority;
+extern int rt_cpu;
+extern int rt_busy;
+
+int rt_parse_priority __P(( const char *s ));
+int rt_parse_cpu __P(( const char *s ));
+int rt_pin __P(( int cpu ));
+int rt_setup __P(( void ));
+void rt_release __P(( void ));
+ssize_t rt_read __P(( int fd, void *buf, size_t len ));
+int rt_select __P(( int nfds, fd_set *rfds, struct timeval *tv ));
@@ -2,12 +2,66 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
 #include <alsa/asoundlib.h>
 
+#include "seq.h"
+#include "ring.h"
+#include "rt.h"
+#include "stats.h"
+#include "rec.h"
+#include "quant.h"
+
 extern snd_seq_t *seq;
 extern int port;
 extern int verbose;
 
+int threaded_output = 0;
+int output_cpu = -1;
+int output_lanes = 1;								/* one per producer thread */
+long merge_window = 0;								/* uS, 0 == don't reorder */
+
+static struct mpsc queue;
+static __thread int lane = 0;						/* calling thread's lane */
+static __thread struct timespec event_time;			/* of the input being handled */
+static pthread_t output_thread;
+static int output_running = 0;					/* read and written atomically */
+
+/* sequencer setup running alongside device setup */
+static pthread_t setup_thread;
+static const char *setup_name;
+static const char *setup_sub;
+static int setup_result;
+
+#define MAX_PORTS 16								/* of ours, watched for subscribers */
+
+/* notes we have started and not yet stopped, by port and channel */
+static unsigned char sounding[ MAX_PORTS ][ 16 ][ 128 ];
+
+/* The controller, program and pitch bend state we have sent from each port,
+ * by channel, for bringing new subscribers up to date. Values are stored
+ * plus one (bend plus 8193), so that 0 means never sent. */
+struct shadow {
+	unsigned char cc[ 16 ][ 120 ];					/* 120 up are channel mode */
+	unsigned char program[ 16 ];
+	unsigned short bend[ 16 ];
+};
+
+static struct shadow shadow[ MAX_PORTS ];
+
+/* number of subscribers to each port; until we're watching, assume some */
+static int listeners[ MAX_PORTS ] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+
+static int announce_port = -1;
+static int watching = 0;
+static pthread_t input_thread;
+static int input_started = 0;
+
 /** 
  * register client with ALSA
  */
@@ -16,7 +70,8 @@ open_client ( const char *name )
 {
 	snd_seq_t *handle;
 	int err;
-	err = snd_seq_open( &handle, "default", SND_SEQ_OPEN_OUTPUT, 0 );
+	/* input is for MIDI clock */
+	err = snd_seq_open( &handle, "default", SND_SEQ_OPEN_DUPLEX, 0 );
 	if ( err < 0 )
 		return NULL;
 	snd_seq_set_client_name( handle, name );
@@ -29,24 +84,158 @@ open_client ( const char *name )
 int
 open_output_port ( snd_seq_t *handle )
 {
-	return snd_seq_create_simple_port( handle, "Output",
+	return open_named_output_port( handle, "Output" );
+}
+
+/**
+ * Open an additional output port called /name/ and return the ID
+ */
+int
+open_named_output_port ( snd_seq_t *handle, const char *name )
+{
+	int p = snd_seq_create_simple_port( handle, name,
 			   SND_SEQ_PORT_CAP_READ |
 			   SND_SEQ_PORT_CAP_SUBS_READ,
 			   SND_SEQ_PORT_TYPE_MIDI_GENERIC |
 			   SND_SEQ_PORT_TYPE_APPLICATION );
+
+	/* nobody can have subscribed yet, and we'll hear when they do */
+	if ( p >= 0 && p < MAX_PORTS && watching )
+		__atomic_store_n( &listeners[ p ], 0, __ATOMIC_RELAXED );
+
+	return p;
 }
 
-/** 
- * Send sequencer event pointed to by /ev/ to open port without delay.
+/**
+ * Open client /name/ and its output port, and connect it to /sub_name/ if
+ * that isn't NULL. Returns -1 (having complained) on failure.
+ */
+int
+setup_client ( const char *name, const char *sub_name )
+{
+	if ( ( seq = open_client( name ) ) == NULL )
+	{
+		fprintf( stderr, "Error opening alsa sequencer!\n" );
+		return -1;
+	}
+
+	if ( ( port = open_output_port( seq ) ) < 0 )
+	{
+		fprintf( stderr, "Error opening MIDI output port!\n" );
+		return -1;
+	}
+
+	if ( sub_name )
+	{
+		snd_seq_addr_t addr;
+
+		if ( snd_seq_parse_address( seq, &addr, sub_name ) < 0 )
+			fprintf( stderr, "Couldn't parse address '%s'\n", sub_name );
+		else
+		if ( snd_seq_connect_to( seq, port, addr.client, addr.port ) < 0 )
+		{
+			fprintf( stderr, "Error creating subscription for port %i:%i\n",
+					 addr.client, addr.port );
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void *
+setup_loop ( void *arg )
+{
+	setup_result = setup_client( setup_name, setup_sub );
+
+	return NULL;
+}
+
+/**
+ * Start setting up the sequencer client (as setup_client()) in the
+ * background, since loading the ALSA configuration can take a while on a
+ * small board. Neither /seq/ nor /port/ may be touched until
+ * finish_client_setup() has returned.
  */
 void
-send_event ( snd_seq_event_t *ev )
+start_client_setup ( const char *name, const char *sub_name )
 {
-		snd_seq_ev_set_direct( ev );
-		snd_seq_ev_set_source( ev, port );
-		snd_seq_ev_set_subs( ev );
+	setup_name = name;
+	setup_sub = sub_name;
+
+	if ( pthread_create( &setup_thread, NULL, setup_loop, NULL ) )
+	{
+		/* do it the slow way, then */
+		setup_result = setup_client( name, sub_name );
+		setup_name = NULL;
+	}
+}
+
+/**
+ * Wait for the sequencer client set up by start_client_setup(), if it isn't
+ * ready already. Returns -1 if it couldn't be.
+ */
+int
+finish_client_setup ( void )
+{
+	if ( setup_name )
+		pthread_join( setup_thread, NULL );
+
+	setup_name = NULL;
+
+	return setup_result;
+}
+
+/**
+ * Keep track of which notes are sounding, given event /ev/ about to go out.
+ * A note off scheduled on the quantization queue hasn't happened yet, and
+ * quant_flush() may take it back, so until a direct one comes along the note
+ * counts as sounding; at worst release_notes() stops it twice.
+ */
+static void
+track_notes ( const snd_seq_event_t *ev )
+{
+	unsigned char (*s)[ 128 ];
+
+	if ( ev->source.port >= MAX_PORTS )
+		return;
+
+	s = sounding[ ev->source.port ];
+
+	switch ( ev->type )
+	{
+		case SND_SEQ_EVENT_NOTEON:
+			if ( ev->data.note.velocity )
+			{
+				s[ ev->data.note.channel & 15 ][ ev->data.note.note & 127 ] = 1;
+				break;
+			}
+		case SND_SEQ_EVENT_NOTEOFF:
+			if ( ev->queue == SND_SEQ_QUEUE_DIRECT )
+				s[ ev->data.note.channel & 15 ][ ev->data.note.note & 127 ] = 0;
+			break;
+		case SND_SEQ_EVENT_CONTROLLER:
+			/* all notes off */
+			if ( ev->data.control.param == 123 )
+				memset( s[ ev->data.control.channel & 15 ], 0,
+						sizeof( s[0] ) );
+			break;
+	}
+}
+
+/**
+ * Write event pointed to by /ev/ to the sequencer (from whichever thread
+ * does output)
+ */
+static void
+output_event ( snd_seq_event_t *ev )
+{
+		track_notes( ev );
+
 		snd_seq_event_output_direct( seq, ev );
 
+		rec_output( ev );
+
 		if ( verbose == 1 ) 
 		{	
 			switch ( ev->type )
@@ -74,4 +263,567 @@ send_event ( snd_seq_event_t *ev )
 		}
 }
 
+/**
+ * Is time /a/ later than time /b/?
+ */
+static int
+later ( const struct timespec *a, const struct timespec *b )
+{
+	return a->tv_sec > b->tv_sec ||
+		( a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec );
+}
+
+/**
+ * Output thread body when merging. Each event is held until /merge_window/
+ * uS after its input happened, so that one from another device which
+ * happened earlier, but was read (or queued) later, can still go out first.
+ * Events are then written in the order their inputs happened.
+ */
+static void
+merge_loop ( void )
+{
+	static struct heap heap;
+	struct timespec last = { 0, 0 };				/* latest /when/ written */
+	struct timespec newest = { 0, 0 };				/* latest /when/ taken */
+	unsigned long taken = 0, written = 0;
+	struct slot s;
+
+	for ( ;; )
+	{
+		struct timespec now, due;
+		int more = 0;
+
+		while ( heap.count < HEAP_SIZE && ( more = mpsc_pop( &queue, &s ) ) )
+		{
+			s.order = taken++;
+
+			if ( later( &newest, &s.when ) )
+				/* how far out of order it came, and whether what it should
+				 * have followed is already out */
+				stats_skew( ( newest.tv_sec - s.when.tv_sec ) * 1000000 +
+							( newest.tv_nsec - s.when.tv_nsec ) / 1000,
+							later( &last, &s.when ) );
+			else
+				newest = s.when;
+
+			heap_push( &heap, &s );
+		}
+
+		clock_gettime( CLOCK_MONOTONIC, &now );
+
+		while ( heap.count )
+		{
+			due = heap.slot[ 0 ].when;
+			due.tv_nsec += merge_window * 1000;
+			due.tv_sec += due.tv_nsec / 1000000000;
+			due.tv_nsec %= 1000000000;
+
+			/* hold it, unless there's no room or we're stopping */
+			if ( later( &due, &now ) && heap.count < HEAP_SIZE &&
+				 __atomic_load_n( &output_running, __ATOMIC_ACQUIRE ) )
+				break;
+
+			heap_pop( &heap, &s );
+
+			/* did something taken after it go out before it? */
+			stats_merged( s.order < written );
+
+			if ( s.order >= written )
+				written = s.order + 1;
+
+			if ( later( &s.when, &last ) )
+				last = s.when;
+
+			output_event( &s.ev );
+			stats_record( &s.stamp );
+		}
+
+		if ( more )
+			continue;
+
+		if ( ! heap.count )
+		{
+			if ( ! __atomic_load_n( &output_running, __ATOMIC_ACQUIRE ) )
+				break;
+
+			mpsc_wait( &queue );
+		}
+		else
+			mpsc_wait_until( &queue, &due );
+	}
+}
+
+/**
+ * Output thread. Drains the queue into the sequencer so that a blocking write
+ * never holds up the input thread.
+ */
+static void *
+output_loop ( void *arg )
+{
+	struct slot s;
+
+	if ( rt_pin( output_cpu ) < 0 )
+		fprintf( stderr, "Couldn't pin output thread to CPU %i! (%s)\n",
+				 output_cpu, strerror( errno ) );
+
+	if ( merge_window )
+	{
+		merge_loop();
+		return NULL;
+	}
+
+	for ( ;; )
+	{
+		if ( mpsc_pop( &queue, &s ) )
+		{
+			output_event( &s.ev );
+			stats_record( &s.stamp );
+			continue;
+		}
+
+		if ( ! __atomic_load_n( &output_running, __ATOMIC_ACQUIRE ) )
+			break;
+
+		mpsc_wait( &queue );
+	}
+
+	return NULL;
+}
+
+/**
+ * Start output thread, if requested. Call after rt_setup() so that the
+ * thread inherits the realtime policy and memory locks. The queue is made
+ * the first time; starting again after stop_output_thread() (when a
+ * handover falls through) reuses it, empty as the thread left it.
+ */
+int
+start_output_thread ( void )
+{
+	if ( ! threaded_output )
+		return 0;
+
+	if ( ! queue.lane && mpsc_init( &queue, output_lanes ) < 0 )
+	{
+		fprintf( stderr, "Error creating output queue! (%s)\n", strerror( errno ) );
+		return -1;
+	}
+
+	__atomic_store_n( &output_running, 1, __ATOMIC_RELEASE );
+
+	if ( pthread_create( &output_thread, NULL, output_loop, NULL ) )
+	{
+		fprintf( stderr, "Error starting output thread!\n" );
+		__atomic_store_n( &output_running, 0, __ATOMIC_RELEASE );
+		return -1;
+	}
+
+	fprintf( stderr, "Output thread started%s.\n",
+			 output_cpu >= 0 ? " (pinned)" : "" );
+
+	return 0;
+}
+
+/**
+ * Flush whatever is left in the queue and stop the output thread.
+ */
+void
+stop_output_thread ( void )
+{
+	unsigned long overruns = 0;
+	int i;
+
+	if ( ! __atomic_load_n( &output_running, __ATOMIC_ACQUIRE ) )
+		return;
+
+	__atomic_store_n( &output_running, 0, __ATOMIC_RELEASE );
+
+	mpsc_kick( &queue );
+
+	pthread_join( output_thread, NULL );
+
+	for ( i = 0; i < queue.nlanes; i++ )
+	{
+		overruns += queue.lane[ i ].overruns;
+		queue.lane[ i ].overruns = 0;
+	}
+
+	if ( overruns )
+		fprintf( stderr, "Output queue was full for %lu event(s).\n", overruns );
+}
+
+/**
+ * Select the output lane used by events sent from the calling thread. Each
+ * producer thread must have its own, below /output_lanes/.
+ */
+void
+set_output_lane ( int n )
+{
+	lane = n;
+}
+
+/**
+ * Note the kernel's timestamp, /tv/, of the input event the calling thread
+ * is about to handle, for ordering its output against other devices'. The
+ * device should be using CLOCK_MONOTONIC (EVIOCSCLOCKID). NULL, once it has
+ * been handled, means events sent from here on are stamped when sent.
+ */
+void
+set_event_time ( const struct timeval *tv )
+{
+	if ( ! tv )
+	{
+		event_time.tv_sec = event_time.tv_nsec = 0;
+		return;
+	}
+
+	event_time.tv_sec = tv->tv_sec;
+	event_time.tv_nsec = tv->tv_usec * 1000;
+}
+
+/**
+ * Note the controller, program or pitch bend state set by event /ev/ from
+ * port /src/.
+ */
+static void
+track_state ( int src, const snd_seq_event_t *ev )
+{
+	struct shadow *sh;
+	int c;
+
+	if ( src < 0 || src >= MAX_PORTS )
+		return;
+
+	sh = &shadow[ src ];
+	c = ev->data.control.channel & 15;
+
+	switch ( ev->type )
+	{
+		case SND_SEQ_EVENT_CONTROLLER:
+			if ( ev->data.control.param < 120 )
+				sh->cc[ c ][ ev->data.control.param ] =
+					( ev->data.control.value & 127 ) + 1;
+			else
+			if ( ev->data.control.param == 121 )
+			{
+				/* reset all controllers */
+				memset( sh->cc[ c ], 0, sizeof( sh->cc[ c ] ) );
+				sh->bend[ c ] = 0;
+			}
+			break;
+		case SND_SEQ_EVENT_PGMCHANGE:
+			sh->program[ c ] = ( ev->data.control.value & 127 ) + 1;
+			break;
+		case SND_SEQ_EVENT_PITCHBEND:
+			sh->bend[ c ] = ev->data.control.value + 8193;
+			break;
+	}
+}
+
+/** 
+ * Send sequencer event pointed to by /ev/ to open port without delay.
+ */
+void
+send_event ( snd_seq_event_t *ev )
+{
+		send_event_from( port, ev );
+}
+
+/** 
+ * Send sequencer event pointed to by /ev/ from port /src/ without delay.
+ */
+void
+send_event_from ( int src, snd_seq_event_t *ev )
+{
+		struct timespec stamp, when;
+
+		snd_seq_ev_set_direct( ev );
+		snd_seq_ev_set_source( ev, src );
+		snd_seq_ev_set_subs( ev );
+
+		track_state( src, ev );
+
+		/* nobody to hear it; what it changed will be sent on subscription */
+		if ( src >= 0 && src < MAX_PORTS &&
+			 ! __atomic_load_n( &listeners[ src ], __ATOMIC_RELAXED ) )
+			return;
+
+		quant_event( ev );
+
+		stats_stamp( &stamp );
+
+		if ( __atomic_load_n( &output_running, __ATOMIC_ACQUIRE ) )
+		{
+			/* it can't have happened after we read it; if it seems to, the
+			 * device's clock isn't ours */
+			when = event_time.tv_sec && ! later( &event_time, &stamp ) ?
+				event_time : stamp;
+
+			mpsc_push( &queue, lane, ev, &stamp, &when );
+			return;
+		}
+
+		output_event( ev );
+
+		if ( stats_enabled || rec_threshold )
+			stats_record( &stamp );
+}
+
+/**
+ * Stop every note still sounding, from the port that started it. The output
+ * thread must not be running.
+ */
+void
+release_notes ( void )
+{
+	snd_seq_event_t ev;
+	int p, c, n;
+
+	for ( p = 0; p < MAX_PORTS; p++ )
+		for ( c = 0; c < 16; c++ )
+			for ( n = 0; n < 128; n++ )
+				if ( sounding[ p ][ c ][ n ] )
+				{
+					snd_seq_ev_clear( &ev );
+					snd_seq_ev_set_noteoff( &ev, c, n, 0 );
+
+					send_event_from( p, &ev );
+				}
+}
+
+/**
+ * Fill in up to /max/ addresses subscribed to our port /p/ (just count them
+ * if /addr/ is NULL). Returns the number found.
+ */
+static int
+port_subscribers ( int p, snd_seq_addr_t *addr, int max )
+{
+	snd_seq_query_subscribe_t *qs;
+	snd_seq_addr_t root;
+	int n = 0;
+
+	snd_seq_query_subscribe_alloca( &qs );
+
+	root.client = snd_seq_client_id( seq );
+	root.port = p;
+
+	snd_seq_query_subscribe_set_root( qs, &root );
+	snd_seq_query_subscribe_set_type( qs, SND_SEQ_QUERY_SUBS_READ );
+	snd_seq_query_subscribe_set_index( qs, 0 );
+
+	while ( n < max && snd_seq_query_port_subscribers( seq, qs ) >= 0 )
+	{
+		if ( addr )
+			addr[ n ] = *snd_seq_query_subscribe_get_addr( qs );
+
+		n++;
+
+		snd_seq_query_subscribe_set_index( qs,
+			snd_seq_query_subscribe_get_index( qs ) + 1 );
+	}
+
+	return n;
+}
+
+/**
+ * Fill in up to /max/ addresses subscribed to our output port. Returns the
+ * number found.
+ */
+int
+get_subscribers ( snd_seq_addr_t *addr, int max )
+{
+	return port_subscribers( port, addr, max );
+}
+
+/**
+ * Connect our output port to each of the /n/ addresses in /addr/, ignoring
+ * those we're already connected to. Returns the number of new connections.
+ */
+int
+subscribe_to ( const snd_seq_addr_t *addr, int n )
+{
+	int i, made = 0;
+
+	for ( i = 0; i < n; i++ )
+		if ( snd_seq_connect_to( seq, port, addr[ i ].client,
+								 addr[ i ].port ) == 0 )
+			made++;
+
+	return made;
+}
+
+/**
+ * Bring /dest/, newly subscribed to our port /p/, up to date with the
+ * controller, program and pitch bend state we have sent from it. Data entry
+ * (6, 38, 96 and 97) and the RPN and NRPN selects (98 to 101) are left out:
+ * which parameter the data was for depends on which select came last, and
+ * we don't keep that.
+ *
+ * This runs on the input thread while the output thread may be writing
+ * too. That is safe: snd_seq_event_output_direct() hands a fixed length
+ * event to the kernel in a single write() from the caller's own buffer,
+ * never touching the handle's output buffer, and the kernel keeps each
+ * event whole.
+ */
+static void
+send_state ( int p, const snd_seq_addr_t *dest )
+{
+	struct shadow *sh = &shadow[ p ];
+	snd_seq_event_t ev;
+	int c, i, n = 0;
+
+	for ( c = 0; c < 16; c++ )
+	{
+		/* bank select (0 and 32) goes before the program, as it should */
+		for ( i = 0; i < 120; i++ )
+			if ( sh->cc[ c ][ i ] &&
+				 i != 6 && i != 38 && ( i < 96 || i > 101 ) )
+			{
+				snd_seq_ev_clear( &ev );
+				snd_seq_ev_set_controller( &ev, c, i, sh->cc[ c ][ i ] - 1 );
+				snd_seq_ev_set_source( &ev, p );
+				snd_seq_ev_set_dest( &ev, dest->client, dest->port );
+				snd_seq_ev_set_direct( &ev );
+
+				snd_seq_event_output_direct( seq, &ev );
+				n++;
+			}
+
+		if ( sh->program[ c ] )
+		{
+			snd_seq_ev_clear( &ev );
+			snd_seq_ev_set_pgmchange( &ev, c, sh->program[ c ] - 1 );
+			snd_seq_ev_set_source( &ev, p );
+			snd_seq_ev_set_dest( &ev, dest->client, dest->port );
+			snd_seq_ev_set_direct( &ev );
+
+			snd_seq_event_output_direct( seq, &ev );
+			n++;
+		}
+
+		if ( sh->bend[ c ] )
+		{
+			snd_seq_ev_clear( &ev );
+			snd_seq_ev_set_pitchbend( &ev, c, sh->bend[ c ] - 8193 );
+			snd_seq_ev_set_source( &ev, p );
+			snd_seq_ev_set_dest( &ev, dest->client, dest->port );
+			snd_seq_ev_set_direct( &ev );
+
+			snd_seq_event_output_direct( seq, &ev );
+			n++;
+		}
+	}
+
+	if ( verbose )
+		printf( "Sent %i state event(s) to new subscriber %i:%i.\n",
+				n, dest->client, dest->port );
+}
+
+/**
+ * Handle announcement /ev/ from the system: if it's about a subscription
+ * to one of our ports, recount that port's subscribers and bring a new
+ * one up to date.
+ */
+static void
+announcement ( const snd_seq_event_t *ev )
+{
+	const snd_seq_addr_t *from = &ev->data.connect.sender;
+	int n;
+
+	if ( ( ev->type != SND_SEQ_EVENT_PORT_SUBSCRIBED &&
+		   ev->type != SND_SEQ_EVENT_PORT_UNSUBSCRIBED ) ||
+		 from->client != snd_seq_client_id( seq ) ||
+		 from->port >= MAX_PORTS )
+		return;
+
+	/* the state first, so nothing we play goes out ahead of it */
+	if ( ev->type == SND_SEQ_EVENT_PORT_SUBSCRIBED )
+		send_state( from->port, &ev->data.connect.dest );
+
+	n = port_subscribers( from->port, NULL, 1000 );
+
+	__atomic_store_n( &listeners[ from->port ], n, __ATOMIC_RELAXED );
+
+	if ( verbose )
+		printf( "Port %i has %i subscriber(s).\n", from->port, n );
+}
+
+/**
+ * Input thread. Reads announcements and, when quantizing to it, MIDI clock.
+ */
+static void *
+input_loop ( void *arg )
+{
+	snd_seq_event_t *ev;
+	sigset_t all;
+
+	/* signals are for the event thread to handle */
+	sigfillset( &all );
+	pthread_sigmask( SIG_BLOCK, &all, NULL );
+
+	for ( ;; )
+	{
+		if ( snd_seq_event_input( seq, &ev ) < 0 )
+			continue;								/* overrun, nothing to do */
+
+		if ( ev->dest.port == announce_port )
+			announcement( ev );
+		else
+			quant_clock( ev );
+	}
 
+	return NULL;
+}
+
+/**
+ * Start watching our ports' subscriptions (and reading MIDI clock, if
+ * quantizing to it), so that nothing is sent to nobody. Call once all
+ * ports are open. Returns -1 if the thread couldn't be started.
+ */
+int
+start_input_thread ( void )
+{
+	int p;
+
+	/* a port of our own to receive announcements at, that nobody else can
+	 * connect to */
+	if ( ( announce_port = snd_seq_create_simple_port( seq, "Announce",
+					SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT,
+					SND_SEQ_PORT_TYPE_APPLICATION ) ) < 0 ||
+		 snd_seq_connect_from( seq, announce_port, SND_SEQ_CLIENT_SYSTEM,
+							   SND_SEQ_PORT_SYSTEM_ANNOUNCE ) < 0 )
+		fprintf( stderr, "Can't watch for subscribers; sending regardless.\n" );
+	else
+	{
+		/* anything subscribed before we started watching */
+		for ( p = 0; p < MAX_PORTS; p++ )
+			__atomic_store_n( &listeners[ p ], port_subscribers( p, NULL, 1000 ),
+							  __ATOMIC_RELAXED );
+
+		watching = 1;
+	}
+
+	if ( pthread_create( &input_thread, NULL, input_loop, NULL ) )
+	{
+		fprintf( stderr, "Error starting input thread!\n" );
+		return -1;
+	}
+
+	input_started = 1;
+
+	return 0;
+}
+
+/**
+ * Stop reading from the sequencer
+ */
+void
+stop_input_thread ( void )
+{
+	if ( ! input_started || pthread_equal( input_thread, pthread_self() ) )
+		return;
+
+	pthread_cancel( input_thread );
+	pthread_join( input_thread, NULL );
+
+	input_started = 0;
+}
@@ -1,5 +1,24 @@
 
+extern int threaded_output;
+extern int output_cpu;
+extern int output_lanes;
+extern long merge_window;
+
 snd_seq_t * open_client __P(( const char *name ));
 int open_output_port __P(( snd_seq_t *handle ));
+int open_named_output_port __P(( snd_seq_t *handle, const char *name ));
+int setup_client __P(( const char *name, const char *sub_name ));
+void start_client_setup __P(( const char *name, const char *sub_name ));
+int finish_client_setup __P(( void ));
+int start_output_thread __P(( void ));
+void stop_output_thread __P(( void ));
+void set_output_lane __P(( int n ));
+void set_event_time __P(( const struct timeval *tv ));
 void send_event __P(( snd_seq_event_t *ev ));
+void send_event_from __P(( int src, snd_seq_event_t *ev ));
+void release_notes __P(( void ));
+int get_subscribers __P(( snd_seq_addr_t *addr, int max ));
+int subscribe_to __P(( const snd_seq_addr_t *addr, int n ));
+int start_input_thread __P(( void ));
+void stop_input_thread __P(( void ));
 
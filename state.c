@@ -0,0 +1,130 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <alsa/asoundlib.h>
+
+#include "seq.h"
+#include "state.h"
+
+/* the settings in a struct perf_state */
+static const struct {
+	const char *name;
+	size_t offset;
+} fields[] = {
+	{ "channel", offsetof( struct perf_state, channel ) },
+	{ "octave", offsetof( struct perf_state, octave ) },
+	{ "patch", offsetof( struct perf_state, patch ) },
+	{ "bank", offsetof( struct perf_state, bank ) },
+	{ "mode", offsetof( struct perf_state, prog_mode ) },
+	{ "patch page", offsetof( struct perf_state, patch_page ) },
+	{ "bank page", offsetof( struct perf_state, bank_page ) },
+};
+
+#define FIELD(ps, i) ( (int32_t *)( (char *)(ps) + fields[ i ].offset ) )
+
+/**
+ * Bring each setting in /ps/, restored from /filename/, within /lo/ and
+ * /hi/, complaining about any that weren't.
+ */
+static void
+check_state ( struct perf_state *ps, const struct perf_state *lo,
+			  const struct perf_state *hi, const char *filename )
+{
+	int i;
+
+	for ( i = 0; i < sizeof( fields ) / sizeof( fields[0] ); i++ )
+	{
+		int32_t *v = FIELD( ps, i );
+		int32_t l = *FIELD( lo, i ), h = *FIELD( hi, i );
+
+		if ( *v >= l && *v <= h )
+			continue;
+
+		fprintf( stderr, "'%s' has %s %i, which is out of range; using %i.\n",
+				 filename, fields[ i ].name, *v, *v < l ? l : h );
+
+		*v = *v < l ? l : h;
+	}
+}
+
+/**
+ * Map state file /filename/, creating it from /defaults/ if it doesn't exist
+ * or isn't valid. Sets /restored/ if a previous state was found, and brings
+ * whatever it says within /lo/ and /hi/. Falls back to /defaults/ (unsaved)
+ * if the file can't be had.
+ */
+struct perf_state *
+state_open ( const char *filename, struct perf_state *defaults,
+			 const struct perf_state *lo, const struct perf_state *hi,
+			 int *restored )
+{
+	struct perf_state *ps;
+	int sfd;
+
+	*restored = 0;
+
+	defaults->magic = STATE_MAGIC;
+	defaults->version = STATE_VERSION;
+
+	if ( ! filename )
+		return defaults;
+
+	if ( -1 == ( sfd = open( filename, O_RDWR | O_CREAT, 0666 ) ) ||
+		 ftruncate( sfd, sizeof( *ps ) ) < 0 )
+		goto fail;
+
+	ps = mmap( NULL, sizeof( *ps ), PROT_READ | PROT_WRITE, MAP_SHARED, sfd, 0 );
+
+	close( sfd );
+	sfd = -1;
+
+	if ( ps == MAP_FAILED )
+		goto fail;
+
+	if ( ps->magic == STATE_MAGIC && ps->version == STATE_VERSION )
+	{
+		check_state( ps, lo, hi, filename );
+		*restored = 1;
+	}
+	else
+		*ps = *defaults;
+
+	return ps;
+
+fail:
+
+	fprintf( stderr, "Couldn't use state file '%s'! (%s)\n",
+			 filename, strerror( errno ) );
+
+	if ( sfd >= 0 )
+		close( sfd );
+
+	return defaults;
+}
+
+/**
+ * Send current bank and program as one burst, to bring the synths back in
+ * line with restored state /ps/.
+ */
+void
+state_resend ( struct perf_state *ps )
+{
+	snd_seq_event_t ev;
+
+	snd_seq_ev_clear( &ev );
+	snd_seq_ev_set_controller( &ev, ps->channel, 0, ps->bank );
+	send_event( &ev );
+
+	snd_seq_ev_clear( &ev );
+	snd_seq_ev_set_pgmchange( &ev, ps->channel, ps->patch );
+	send_event( &ev );
+
+	fprintf( stderr, "Resent bank %i, program %i on channel %i.\n",
+			 ps->bank, ps->patch, ps->channel + 1 );
+}
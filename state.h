@@ -0,0 +1,20 @@
+
+#define STATE_MAGIC 0x494d534c						/* "LSMI" */
+#define STATE_VERSION 1
+
+/* Musical state that must survive a restart. Kept in a small mmapped file
+ * and updated with plain stores, so it costs nothing to keep current. */
+struct perf_state {
+	uint32_t magic;
+	uint32_t version;
+	int32_t channel;
+	int32_t octave;
+	int32_t patch;
+	int32_t bank;
+	int32_t prog_mode;
+	int32_t patch_page;
+	int32_t bank_page;
+};
+
+struct perf_state * state_open __P(( const char *filename, struct perf_state *defaults, const struct perf_state *lo, const struct perf_state *hi, int *restored ));
+void state_resend __P(( struct perf_state *ps ));
@@ -0,0 +1,203 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <alsa/asoundlib.h>
+
+#include "seq.h"
+#include "rec.h"
+
+/* one bucket per microsecond, everything slower lands in the last one */
+#define HIST_MAX 10000
+
+int stats_enabled = 0;
+
+static __thread struct timespec mark;				/* last input arrival */
+
+static unsigned long hist[ HIST_MAX + 1 ];
+static unsigned long count;
+static unsigned long max_us;
+static double total_us;
+
+/* merging events from several devices (see merge_window) */
+static unsigned long merge_count, merge_reordered, merge_late, merge_skewed;
+static long merge_max_skew;
+
+/* devices going over their budget (see pool_rate), and catching up after
+ * losing events; counted from the workers */
+static unsigned long floods, floods_muted, resyncs;
+
+/**
+ * Note the arrival of input on the calling thread.
+ */
+void
+stats_mark ( void )
+{
+	clock_gettime( CLOCK_MONOTONIC, &mark );
+}
+
+/**
+ * Copy the calling thread's last input arrival time into /ts/.
+ */
+void
+stats_stamp ( struct timespec *ts )
+{
+	*ts = mark;
+}
+
+/**
+ * Record the latency from input arrival /since/ to now. Must only be called
+ * from the thread doing output.
+ */
+void
+stats_record ( const struct timespec *since )
+{
+	struct timespec now;
+	long us;
+
+	if ( ! since->tv_sec )
+		return;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+
+	us = ( now.tv_sec - since->tv_sec ) * 1000000 +
+		( now.tv_nsec - since->tv_nsec ) / 1000;
+
+	if ( us < 0 )
+		us = 0;
+
+	hist[ us > HIST_MAX ? HIST_MAX : us ]++;
+
+	if ( us > max_us )
+		max_us = us;
+
+	total_us += us;
+	count++;
+
+	if ( rec_threshold && us > rec_threshold )
+		rec_trigger( 1 );
+}
+
+/**
+ * Record that an event's input happened /us/ before that of one already
+ * taken for output, and whether (/late/) it came too late to be put before
+ * it. Must only be called from the thread doing output.
+ */
+void
+stats_skew ( long us, int late )
+{
+	merge_skewed++;
+
+	if ( us > merge_max_skew )
+		merge_max_skew = us;
+
+	if ( late )
+		merge_late++;
+}
+
+/**
+ * Record that a merged event was written, and whether it had to be
+ * /reordered/ to go out when it did. Must only be called from the thread
+ * doing output.
+ */
+void
+stats_merged ( int reordered )
+{
+	merge_count++;
+
+	if ( reordered )
+		merge_reordered++;
+}
+
+/**
+ * Record that a device started flooding, and whether it was /muted/ for it.
+ */
+void
+stats_flood ( int muted )
+{
+	__atomic_add_fetch( &floods, 1, __ATOMIC_RELAXED );
+
+	if ( muted )
+		__atomic_add_fetch( &floods_muted, 1, __ATOMIC_RELAXED );
+}
+
+/**
+ * Record that a device's state was read back after events were lost.
+ */
+void
+stats_resync ( void )
+{
+	__atomic_add_fetch( &resyncs, 1, __ATOMIC_RELAXED );
+}
+
+/**
+ * Return the latency in uS below which /pct/ percent of events fall.
+ */
+static long
+percentile ( double pct )
+{
+	unsigned long want = count * pct / 100;
+	unsigned long seen = 0;
+	long i;
+
+	for ( i = 0; i <= HIST_MAX; i++ )
+		if ( ( seen += hist[ i ] ) > want )
+			return i;
+
+	return HIST_MAX;
+}
+
+/**
+ * Print input to output latency summary
+ */
+void
+stats_report ( void )
+{
+	if ( ! stats_enabled || ! count )
+		return;
+
+	fprintf( stderr, "Latency (input to output) over %lu events:\n"
+			 "  mean %.1fuS, p50 %liuS, p90 %liuS, p99 %liuS, p99.9 %liuS, max %luuS\n",
+			 count, total_us / count,
+			 percentile( 50 ), percentile( 90 ), percentile( 99 ),
+			 percentile( 99.9 ), max_us );
+
+	if ( merge_window && merge_count )
+		fprintf( stderr, "Merge window %liuS over %lu events:\n"
+				 "  %lu arrived out of order (by up to %liuS), %lu reordered, %lu too late\n",
+				 merge_window, merge_count, merge_skewed, merge_max_skew,
+				 merge_reordered, merge_late );
+
+	if ( floods || resyncs )
+		fprintf( stderr, "Floods: %lu (%lu muted), %lu resync(s) after lost events\n",
+				 floods, floods_muted, resyncs );
+}
+
+static struct timespec loaded;
+
+/**
+ * Note when the program was loaded, before main() gets going
+ */
+static void __attribute__(( constructor ))
+stats_loaded ( void )
+{
+	clock_gettime( CLOCK_MONOTONIC, &loaded );
+}
+
+/**
+ * Report how long it took to get ready, from loading and from boot.
+ */
+void
+stats_startup ( void )
+{
+	struct timespec now, boot;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	clock_gettime( CLOCK_BOOTTIME, &boot );
+
+	fprintf( stderr, "Ready %.1fmS after start, %.2fS after boot.\n",
+			 ( now.tv_sec - loaded.tv_sec ) * 1000.0 +
+			 ( now.tv_nsec - loaded.tv_nsec ) / 1000000.0,
+			 boot.tv_sec + boot.tv_nsec / 1e9 );
+}
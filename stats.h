@@ -0,0 +1,12 @@
+
+extern int stats_enabled;
+
+void stats_mark __P(( void ));
+void stats_stamp __P(( struct timespec *ts ));
+void stats_record __P(( const struct timespec *since ));
+void stats_skew __P(( long us, int late ));
+void stats_merged __P(( int reordered ));
+void stats_flood __P(( int muted ));
+void stats_resync __P(( void ));
+void stats_report __P(( void ));
+void stats_startup __P(( void ));
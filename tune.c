@@ -0,0 +1,498 @@
+
+#define _GNU_SOURCE								/* for CPU affinity */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+
+#include "rt.h"
+#include "tune.h"
+
+#define MAX_IRQS 8
+#define MAX_CPUS 256
+
+/* timer jitter check: this many wakeups, this far apart */
+#define CHECK_LOOPS 2000
+#define CHECK_PERIOD 500000							/* in nanoseconds */
+
+int tune_mode = TUNE_OFF;
+
+struct irq {
+	int number;
+	unsigned long count[ MAX_CPUS ];				/* per CPU, so far */
+	char action[ 128 ];
+};
+
+static int ncpus;
+static unsigned long cpu_total[ MAX_CPUS ];			/* all IRQs, per CPU */
+
+/**
+ * Read the first line of sysfs/procfs file /path/ into /buf/. Returns -1 if
+ * it can't be read.
+ */
+static int
+read_line ( const char *path, char *buf, size_t len )
+{
+	FILE *fp;
+
+	if ( ! ( fp = fopen( path, "r" ) ) )
+		return -1;
+
+	if ( ! fgets( buf, len, fp ) )
+		*buf = '\0';
+
+	fclose( fp );
+
+	buf[ strcspn( buf, "\n" ) ] = '\0';
+
+	return 0;
+}
+
+/**
+ * Fill in the IRQ(s) of sysfs device directory /dir/, if it has any, and
+ * return how many.
+ */
+static int
+device_irqs ( const char *dir, struct irq *irqs, int max )
+{
+	char path[ PATH_MAX + 16 ];
+	char buf[ 32 ];
+	struct dirent *de;
+	DIR *d;
+	int n = 0;
+
+	/* MSI vectors are what actually fire, when there are any */
+	snprintf( path, sizeof( path ), "%s/msi_irqs", dir );
+
+	if ( ( d = opendir( path ) ) )
+	{
+		while ( n < max && ( de = readdir( d ) ) )
+			if ( de->d_name[0] != '.' )
+				irqs[ n++ ].number = atoi( de->d_name );
+
+		closedir( d );
+
+		if ( n )
+			return n;
+	}
+
+	snprintf( path, sizeof( path ), "%s/irq", dir );
+
+	if ( read_line( path, buf, sizeof( buf ) ) == 0 && atoi( buf ) > 0 )
+	{
+		irqs[ 0 ].number = atoi( buf );
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Put the name of the driver bound to sysfs device directory /dir/ in /buf/
+ */
+static void
+device_driver ( const char *dir, char *buf, size_t len )
+{
+	char path[ PATH_MAX + 16 ];
+	char link[ PATH_MAX ];
+	ssize_t n;
+
+	*buf = '\0';
+
+	snprintf( path, sizeof( path ), "%s/driver", dir );
+
+	if ( ( n = readlink( path, link, sizeof( link ) - 1 ) ) < 0 )
+		return;
+
+	link[ n ] = '\0';
+
+	snprintf( buf, len, "%s", strrchr( link, '/' ) ? strrchr( link, '/' ) + 1 : link );
+}
+
+/**
+ * Is /name/ one of the handlers in /proc/interrupts action list /actions/?
+ * Handlers are separated by ", " and may carry a ":detail" suffix.
+ */
+static int
+has_handler ( const char *actions, const char *name )
+{
+	const char *p = actions;
+	size_t len = strlen( name );
+
+	while ( ( p = strstr( p, name ) ) )
+	{
+		if ( ( p == actions || p[ -1 ] == ' ' || p[ -1 ] == ',' ) &&
+			 strchr( ":, ", p[ len ] ) )
+			return 1;
+
+		p += len;
+	}
+
+	return 0;
+}
+
+/**
+ * Read /proc/interrupts. Fills in the per CPU counts of the /n/ IRQs in
+ * /irqs/, or, if /n/ is 0, finds up to /max/ IRQs whose handlers are called
+ * /name/. Returns the number of IRQs known.
+ */
+static int
+read_interrupts ( struct irq *irqs, int n, int max, const char *name )
+{
+	char line[ 4096 ];
+	FILE *fp;
+	int i;
+
+	if ( ! ( fp = fopen( "/proc/interrupts", "r" ) ) )
+		return n;
+
+	/* header: one column per CPU */
+	if ( fgets( line, sizeof( line ), fp ) )
+	{
+		char *tok;
+
+		for ( ncpus = 0, tok = strtok( line, " \t\n" );
+			  tok && ncpus < MAX_CPUS;
+			  tok = strtok( NULL, " \t\n" ) )
+			ncpus++;
+	}
+
+	memset( cpu_total, 0, sizeof( cpu_total ) );
+
+	while ( fgets( line, sizeof( line ), fp ) )
+	{
+		unsigned long count[ MAX_CPUS ];
+		struct irq *irq = NULL;
+		char *p, *end;
+		int number;
+
+		number = strtol( line, &end, 10 );
+
+		if ( end == line || *end != ':' )
+			continue;								/* NMI, LOC and friends */
+
+		for ( p = end + 1, i = 0; i < ncpus; i++, p = end )
+		{
+			count[ i ] = strtoul( p, &end, 10 );
+			cpu_total[ i ] += count[ i ];
+		}
+
+		while ( *p == ' ' )
+			p++;
+
+		p[ strcspn( p, "\n" ) ] = '\0';
+
+		if ( n || ! name )
+		{
+			for ( i = 0; i < n; i++ )
+				if ( irqs[ i ].number == number )
+					irq = &irqs[ i ];
+		}
+		else
+		if ( *name && has_handler( p, name ) )
+		{
+			/* found by name */
+			for ( i = 0; i < max && irqs[ i ].number; i++ )
+				;
+
+			if ( i < max )
+			{
+				irq = &irqs[ i ];
+				irq->number = number;
+			}
+		}
+
+		if ( irq )
+		{
+			memcpy( irq->count, count, sizeof( count[0] ) * ncpus );
+			snprintf( irq->action, sizeof( irq->action ), "%s", p );
+		}
+	}
+
+	fclose( fp );
+
+	if ( ! n )
+		for ( n = 0; n < max && irqs[ n ].number; n++ )
+			;
+
+	return n;
+}
+
+/**
+ * Find the IRQs of the controller behind input device node /device/, by
+ * walking its sysfs path towards the root. Returns the number found.
+ */
+static int
+find_irqs ( const char *device, struct irq *irqs, int max )
+{
+	char link[ 64 ];
+	char dir[ PATH_MAX ];
+	struct stat st;
+	char *p;
+
+	if ( stat( device, &st ) < 0 || ! S_ISCHR( st.st_mode ) )
+	{
+		fprintf( stderr, "'%s' isn't a device node!\n", device );
+		return 0;
+	}
+
+	snprintf( link, sizeof( link ), "/sys/dev/char/%u:%u",
+			  major( st.st_rdev ), minor( st.st_rdev ) );
+
+	if ( ! realpath( link, dir ) )
+	{
+		fprintf( stderr, "Can't find '%s' in sysfs! (%s)\n", device,
+				 strerror( errno ) );
+		return 0;
+	}
+
+	while ( ( p = strrchr( dir, '/' ) ) && p > dir + strlen( "/sys/devices" ) )
+	{
+		char driver[ 64 ];
+		int n;
+
+		*p = '\0';
+
+		device_driver( dir, driver, sizeof( driver ) );
+
+		if ( ( n = device_irqs( dir, irqs, max ) ) )
+		{
+			fprintf( stderr, "'%s' is behind %s (%s).\n", device, dir,
+					 *driver ? driver : "no driver" );
+
+			return read_interrupts( irqs, n, max, NULL );
+		}
+
+		/* legacy (serio etc.) controllers only show up by name */
+		if ( *driver && ( n = read_interrupts( irqs, 0, max, driver ) ) )
+		{
+			fprintf( stderr, "'%s' is behind %s (%s).\n", device, dir,
+					 driver );
+
+			return n;
+		}
+	}
+
+	fprintf( stderr, "Couldn't find an IRQ for '%s'!\n", device );
+
+	return 0;
+}
+
+/**
+ * Pick a CPU to handle input on: the one asked for with -a, or else the one
+ * with the least interrupt load (avoiding CPU 0, which gets everything).
+ */
+static int
+pick_cpu ( void )
+{
+	cpu_set_t allowed;
+	int i, best = -1;
+
+	if ( rt_cpu >= 0 )
+		return rt_cpu;
+
+	sched_getaffinity( 0, sizeof( allowed ), &allowed );
+
+	for ( i = ncpus > 1 ? 1 : 0; i < ncpus; i++ )
+		if ( CPU_ISSET( i, &allowed ) &&
+			 ( best < 0 || cpu_total[ i ] < cpu_total[ best ] ) )
+			best = i;
+
+	return best < 0 ? 0 : best;
+}
+
+static int check_cpu;
+
+static int
+compare_long ( const void *a, const void *b )
+{
+	return *(const long *)a < *(const long *)b ? -1 :
+		*(const long *)a > *(const long *)b;
+}
+
+/**
+ * Timer jitter check thread. Sleeps /CHECK_LOOPS/ times and reports how late
+ * it woke up. This is only how promptly a thread at our priority gets the
+ * CPU back, which is what moving IRQs around changes; it says nothing of the
+ * rest of the way from device to synth, for which see -S.
+ */
+static void *
+check_loop ( void *arg )
+{
+	static long late[ CHECK_LOOPS ];
+	struct timespec next, now;
+	double total = 0;
+	int i;
+
+	rt_pin( check_cpu );
+
+	if ( rt_priority )
+	{
+		struct sched_param sp;
+
+		sp.sched_priority = rt_priority;
+		pthread_setschedparam( pthread_self(), rt_policy, &sp );
+	}
+
+	clock_gettime( CLOCK_MONOTONIC, &next );
+
+	for ( i = 0; i < CHECK_LOOPS; i++ )
+	{
+		next.tv_nsec += CHECK_PERIOD;
+
+		if ( next.tv_nsec >= 1000000000 )
+		{
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+
+		clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL );
+		clock_gettime( CLOCK_MONOTONIC, &now );
+
+		late[ i ] = ( now.tv_sec - next.tv_sec ) * 1000000000L +
+			( now.tv_nsec - next.tv_nsec );
+
+		total += late[ i ];
+	}
+
+	qsort( late, CHECK_LOOPS, sizeof( late[0] ), compare_long );
+
+	if ( check_cpu < 0 )
+		fprintf( stderr, "Timer jitter, unpinned" );
+	else
+		fprintf( stderr, "Timer jitter on CPU %i", check_cpu );
+
+	fprintf( stderr, "%s (not input to output latency; see -S): "
+			 "mean %.1fuS, 99%% %.1fuS, max %.1fuS.\n",
+			 rt_priority ? " (realtime)" : "", total / CHECK_LOOPS / 1000.0,
+			 late[ CHECK_LOOPS * 99 / 100 ] / 1000.0,
+			 late[ CHECK_LOOPS - 1 ] / 1000.0 );
+
+	return NULL;
+}
+
+/**
+ * Measure timer jitter on /cpu/ for a second, at the priority we'll run at.
+ */
+static void
+check ( int cpu )
+{
+	pthread_t t;
+
+	check_cpu = cpu;
+
+	if ( pthread_create( &t, NULL, check_loop, NULL ) == 0 )
+		pthread_join( t, NULL );
+}
+
+/**
+ * Work out where the interrupts of input device node /device/ are handled
+ * and report it, along with a suggested IRQ and thread affinity. When
+ * tune_mode is TUNE_APPLY, also steer the IRQs to that CPU and pin the event
+ * thread there (by way of rt_cpu). Returns -1 if nothing could be found.
+ */
+int
+tune_device ( const char *device )
+{
+	struct irq irqs[ MAX_IRQS ];
+	char path[ 64 ];
+	char buf[ 256 ];
+	int i, j, n, cpu;
+
+	memset( irqs, 0, sizeof( irqs ) );
+
+	if ( ! ( n = find_irqs( device, irqs, MAX_IRQS ) ) )
+		return -1;
+
+	cpu = pick_cpu();
+
+	for ( i = 0; i < n; i++ )
+	{
+		int busiest = 0;
+
+		for ( j = 1; j < ncpus; j++ )
+			if ( irqs[ i ].count[ j ] > irqs[ i ].count[ busiest ] )
+				busiest = j;
+
+		snprintf( path, sizeof( path ), "/proc/irq/%i/smp_affinity_list",
+				  irqs[ i ].number );
+
+		if ( read_line( path, buf, sizeof( buf ) ) < 0 )
+			strcpy( buf, "?" );
+
+		fprintf( stderr, "IRQ %i (%s): affinity %s, handled mostly on CPU %i.\n",
+				 irqs[ i ].number, irqs[ i ].action, buf, busiest );
+	}
+
+	fprintf( stderr, "Suggest handling input on CPU %i: -a %i, and\n", cpu, cpu );
+
+	for ( i = 0; i < n; i++ )
+		fprintf( stderr, "    echo %i > /proc/irq/%i/smp_affinity_list\n",
+				 cpu, irqs[ i ].number );
+
+	check( rt_cpu );
+
+	if ( tune_mode != TUNE_APPLY )
+		return 0;
+
+	for ( i = 0; i < n; i++ )
+	{
+		FILE *fp;
+		int failed;
+
+		snprintf( path, sizeof( path ), "/proc/irq/%i/smp_affinity_list",
+				  irqs[ i ].number );
+
+		if ( ( fp = fopen( path, "w" ) ) )
+		{
+			/* the kernel only says no when the buffer is flushed */
+			failed = fprintf( fp, "%i\n", cpu ) < 0;
+			failed |= fclose( fp ) != 0;
+		}
+		else
+			failed = 1;
+
+		if ( failed )
+			fprintf( stderr, "Couldn't steer IRQ %i to CPU %i! (%s)\n",
+					 irqs[ i ].number, cpu, strerror( errno ) );
+		else
+			fprintf( stderr, "Steered IRQ %i to CPU %i.\n",
+					 irqs[ i ].number, cpu );
+	}
+
+	rt_cpu = cpu;
+
+	check( cpu );
+
+	return 0;
+}
+
+/**
+ * Parse tuning argument: "report" or "apply"
+ */
+int
+tune_parse ( const char *s )
+{
+	if ( ! strcmp( s, "report" ) )
+		tune_mode = TUNE_REPORT;
+	else
+	if ( ! strcmp( s, "apply" ) )
+		tune_mode = TUNE_APPLY;
+	else
+	{
+		fprintf( stderr, "Tuning mode must be 'report' or 'apply'!\n" );
+		return -1;
+	}
+
+	return 0;
+}
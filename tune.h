@@ -0,0 +1,9 @@
+
+#define TUNE_OFF 0
+#define TUNE_REPORT 1								/* report and exit */
+#define TUNE_APPLY 2								/* apply and carry on */
+
+extern int tune_mode;
+
+int tune_parse __P(( const char *s ));
+int tune_device __P(( const char *device ));